@@ -69,9 +69,36 @@ Note: if set, the PIGPIO_ADDR environment variable takes precedence.
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
 
 #include <arpa/inet.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if defined(__arm__)
+#include <sys/auxv.h>
+#endif
+
+/*
+32 bit Raspberry Pi OS builds without -mfpu=neon, so there the NEON
+kernel alone is built for NEON and is only chosen if HWCAP has it.
+*/
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || \
+   (defined(__arm__) && defined(__ARM_FP) && defined(HWCAP_ARM_NEON))
+#define PISCOPE_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__arm__)
+#define PISCOPE_NEON_TARGET __attribute__((target("fpu=neon")))
+#else
+#define PISCOPE_NEON_TARGET
+#endif
+
 #include "piscope.h"
 
 /* DEFINES ---------------------------------------------------------------- */
@@ -82,9 +109,48 @@ Note: if set, the PIGPIO_ADDR environment variable takes precedence.
 
 #define PISCOPE_MILLION              1000000L
 #define PISCOPE_TRIGGERS                    4
+#define PISCOPE_MAX_TRIGGERS               64 /* triggers plus counters */
+#define PISCOPE_COUNTERS (PISCOPE_MAX_TRIGGERS-PISCOPE_TRIGGERS)
+#define PISCOPE_ENGINE_BATCH              256
+#define PISCOPE_SEQUENCES                   4
+#define PISCOPE_STAGES                      4
+#define PISCOPE_MAX_WINDOWS               100
+#define PISCOPE_AUTO_TICKS             200000 /* auto trigger free-runs after */
+#define PISCOPE_HUD_FRAMES                128 /* render times kept for the HUD */
+#define PISCOPE_HUD_LINES                   6
+#define PISCOPE_TRACE_EVENTS          (1<<16) /* per thread, power of 2 */
 #define PISCOPE_GPIOS                      32
-#define PISCOPE_SAMPLES               1000000
+#define PISCOPE_WAVE_RGB             0x339919 /* 0.2, 0.6, 0.1 */
+#define PISCOPE_TICK_COVER                 68 /* 4/15 of 255 */
+#define PISCOPE_RENDER_TILE                64 /* narrowest tile, pixels */
+#define PISCOPE_RENDER_JOBS                16
+#define PISCOPE_TILE_PIX                  256 /* pause mode tile width */
+#define PISCOPE_TILES                      32 /* tiles cached */
+#define PISCOPE_SEG_SHIFT                  16
+#define PISCOPE_SEG_SAMPLES   (1<<PISCOPE_SEG_SHIFT)
+#define PISCOPE_PYR_SHIFT                   4 /* 16 buckets per parent */
+#define PISCOPE_PYR_LEVELS                  4 /* top level is one segment */
+#define PISCOPE_PYR_NODES    (4096+256+16+1)
+#define PISCOPE_BLOCK_SHIFT                 8 /* pyramid level 2 */
+#define PISCOPE_BLOCK_SAMPLES (1<<PISCOPE_BLOCK_SHIFT)
+#define PISCOPE_SEG_BLOCKS \
+   (PISCOPE_SEG_SAMPLES>>PISCOPE_BLOCK_SHIFT)
+#define PISCOPE_HOT_SEGS                    2 /* newest segments not packed */
+#define PISCOPE_PACK_MASK                  32 /* code, full change mask */
+#define PISCOPE_PACK_SAME                  33 /* code, level unchanged */
+#define PISCOPE_EDGE_ALLOC                 16 /* initial edge index entries */
+#define PISCOPE_DEF_BUFFER_MB              64
+#define PISCOPE_MIN_BUFFER_MB              16
+#define PISCOPE_MAX_BUFFER_MB            8192
+#define PISCOPE_MIN_CAPTURE_MB             64
+#define PISCOPE_MAX_CAPTURE_MB \
+   ((sizeof(void *) > 4) ? (1024*1024) : 1536) /* address space */
+#define PISCOPE_MIN_FRAME_RATE              5
+#define PISCOPE_DEF_FRAME_RATE             30
+#define PISCOPE_MAX_FRAME_RATE            240 /* no faster than the display */
 #define PISCOPE_MAX_REPORTS_PER_READ     1000
+#define PISCOPE_CAPTURE_REPORTS    (1<<18) /* must be a power of 2 */
+#define PISCOPE_CAPTURE_POLL_MS           100
 #define PISCOPE_MIN_SPEED_IDX               0
 #define PISCOPE_DEF_SPEED_IDX               6
 #define PISCOPE_MAX_SPEED_IDX              21
@@ -138,7 +204,13 @@ typedef enum
    piscope_high      = 2,
    piscope_edge      = 3,
    piscope_falling   = 4,
-   piscope_rising    = 5
+   piscope_rising    = 5,
+   piscope_high_gt   = 6,  /* high pulse longer than T */
+   piscope_high_lt   = 7,  /* high pulse shorter than T */
+   piscope_low_gt    = 8,
+   piscope_low_lt    = 9,
+   piscope_idle_gt   = 10, /* no edge for longer than T */
+   piscope_runt_lt   = 11  /* pulse of either level shorter than T */
 } piscopeTrigType_t;
 
 typedef enum
@@ -149,12 +221,22 @@ typedef enum
    piscope_sample_to     = 3
 } piscopeTrigWhen_t;
 
+typedef enum
+{
+   piscope_single = 0, /* pause once the windows are captured */
+   piscope_normal = 1, /* hold the last trigger at the centre */
+   piscope_auto   = 2  /* likewise, free-running without triggers */
+} piscopeTrigRepeat_t;
+
 typedef struct
 {
    uint64_t          count;
    uint32_t          levelMask;
    uint32_t          changedMask;
    uint32_t          levelValue;
+   uint32_t          durationMask; /* gpios with a duration condition */
+   uint32_t          idleMask;     /* those with an idle condition */
+   int64_t           micros;
    int               enabled;
    int               fired;
    piscopeTrigWhen_t when;
@@ -181,13 +263,173 @@ typedef struct
    char *name;
 } piscopeGpioUsage_t;
 
+/*
+Samples are held in fixed size segments.  Sample numbers increase from
+zero for as long as the store is not cleared, segment n>>SEG_SHIFT holds
+sample n.  Each segment also carries its part of the display pyramid,
+pyr[] has a bit set for every gpio which changed level somewhere in a
+bucket of 16^k samples, level 1 buckets first.
+
+The newest segments are raw.  Older segments in a memory store are
+packed into blocks of 256 samples.  Each block is found through a
+directory of its first and last tick, the remaining samples are stored
+as a varint tick delta followed by a code byte, either the number of the
+single gpio which changed or PACK_MASK and the full 32 bit change mask.
+
+Every segment also indexes its edges, edge[g] lists in order the offsets
+of the samples at which gpio g changed level, and hit[] lists those at
+which an enabled trigger matched.
+
+Segments are reference counted so that a snapshot of the store can be
+taken without copying samples.  Samples already in a segment never
+change, so the store may go on appending while a snapshot is viewed.
+A snapshot's segments are not counted against the store's budget.
+*/
+
+typedef struct
+{
+   int64_t  tick[PISCOPE_SEG_SAMPLES];
+   uint32_t level[PISCOPE_SEG_SAMPLES];
+   uint32_t pyr[PISCOPE_PYR_NODES];
+} piscopeRaw_t;
+
+typedef struct
+{
+   int64_t  first[PISCOPE_SEG_BLOCKS];
+   int64_t  last[PISCOPE_SEG_BLOCKS];
+   uint32_t level[PISCOPE_SEG_BLOCKS];
+   uint32_t lastLevel[PISCOPE_SEG_BLOCKS];
+   uint32_t pos[PISCOPE_SEG_BLOCKS];
+   uint32_t pyr[PISCOPE_PYR_NODES];
+   size_t   bytes;
+   uint8_t  data[];
+} piscopePacked_t;
+
+typedef struct
+{
+   piscopeRaw_t    *raw;    /* one of raw and packed is set */
+   piscopePacked_t *packed;
+   uint32_t        *pyr;
+   uint16_t        *edge[PISCOPE_GPIOS];
+   int              edges[PISCOPE_GPIOS];
+   int              edgeAlloc[PISCOPE_GPIOS];
+   uint16_t        *hit;
+   int              hits;
+   int              hitAlloc;
+   uint16_t        *gap;    /* reports were lost before these samples */
+   int              gaps;
+   int              gapAlloc;
+   int              refs;   /* stores holding the segment */
+} piscopeSegment_t;
+
+typedef struct
+{
+   piscopeSegment_t **seg;      /* ring of maxSegs segment pointers */
+   int                maxSegs;
+   int                numSegs;  /* segments holding samples */
+   int                headSeg;  /* ring slot of the oldest segment */
+   int64_t            firstSeg; /* segment number of the oldest segment */
+   int64_t            first;    /* oldest sample number */
+   int64_t            next;     /* sample number of the next sample */
+   uint32_t           lastLevel;
+   int64_t            budget;   /* bytes, 0 for a snapshot */
+   int64_t            bytes;    /* bytes of sample data held */
+   piscopeRaw_t      *spare;    /* a freed raw segment kept for reuse */
+   void              *map;      /* file backed segments, if not NULL */
+   size_t             mapBytes;
+} piscopeStore_t;
+
+/* the most recently unpacked block */
+
+typedef struct
+{
+   piscopePacked_t *packed;
+   int              block;
+   int64_t          tick[PISCOPE_BLOCK_SAMPLES];
+   uint32_t         level[PISCOPE_BLOCK_SAMPLES];
+} piscopeUnpacked_t;
+
+/* one segment of a trigger hit rebuild */
+
+typedef struct
+{
+   piscopeStore_t   *st;
+   piscopeSegment_t *seg;
+   int               end;
+   uint32_t          prevLevel;
+   uint16_t         *hit;
+   int               hits;
+   int               hitAlloc;
+   int64_t           count[PISCOPE_TRIGGERS];
+   int64_t           prevTick;
+   int64_t           lastEdge[PISCOPE_GPIOS];
+} piscopeHitJob_t;
+
+/* the pixels a span rasterizer may write */
+
+typedef struct
+{
+   uint32_t *pix;
+   int       stride; /* in pixels */
+   int       x0;     /* clip */
+   int       x1;
+   uint32_t *edges;  /* the columns filled from */
+   uint32_t *level;
+} piscopeRaster_t;
+
+/* a rendered tile of the waveforms, kept while paused */
+
+typedef struct
+{
+   uint32_t *pix;             /* a pixel either side of the tile */
+   int64_t   index;           /* PISCOPE_TILE_PIX pixels from tick 0 */
+   uint32_t  deciMicroPerPix;
+   uint32_t  gpios;           /* those displayed */
+   int       height;
+   int       gen;
+   uint64_t  used;
+} piscopeTile_t;
+
+/* a run of columns scanned, or of pixels filled, by a render worker */
+
+typedef struct
+{
+   int            x0;
+   int            x1;
+   uint32_t       level; /* before column x0 */
+   piscopeTile_t *tile;  /* or the pause mode tile drawn */
+} piscopeRenderJob_t;
+
 typedef struct
 {
    gboolean enabled;
    gint action;
    gint gpiotypes[PISCOPE_GPIOS];
+   gint micros;
 } piscopeTriggerSettings_t;
 
+typedef struct
+{
+   gchar *name;
+   gint gpiotypes[PISCOPE_GPIOS];
+} piscopeCounterSettings_t;
+
+typedef struct
+{
+   gint gpiotypes[PISCOPE_GPIOS];
+   gint holdtypes[PISCOPE_GPIOS];
+   gint repeat;
+   gint within;
+} piscopeStageSettings_t;
+
+typedef struct
+{
+   gchar *name;
+   gint action;
+   gint stages;
+   piscopeStageSettings_t stage[PISCOPE_STAGES];
+} piscopeSequenceSettings_t;
+
 typedef struct
 {
    gchar *serverAddress;
@@ -195,19 +437,120 @@ typedef struct
    gsize activeGPIOCount;
    gint  port;
    gint triggerSamples;
+   gint triggerWindows;
+   gint triggerRepeat;
+   gint triggerHoldoff;
+   gint bufferMB;
+   gchar *captureFile;
+   gint captureMB;
+   gint frameRate;
    piscopeTriggerSettings_t triggers[PISCOPE_TRIGGERS];
+   gint counters;
+   piscopeCounterSettings_t counter[PISCOPE_COUNTERS];
+   gint sequences;
+   piscopeSequenceSettings_t sequence[PISCOPE_SEQUENCES];
 } piscopeSettings_t;
 
+/*
+A sequence fires when its stages match in order.  A stage matches when
+its engine entry has matched repeat times, within micros of the stage
+before completing, while the gpios in holdMask keep holdValue.  A stage
+which does not complete in time, or whose hold is broken, sends the
+sequence back to its first stage.
+*/
+
+typedef struct
+{
+   uint64_t entry;
+   uint32_t holdMask;
+   uint32_t holdValue;
+   int      repeat;
+   int64_t  within;
+} piscopeStage_t;
+
+typedef struct
+{
+   int               stages;
+   piscopeStage_t    stage[PISCOPE_STAGES];
+   piscopeTrigWhen_t when;
+   int               at;      /* stage being matched */
+   int               repeats; /* matches of that stage so far */
+   int64_t           since;   /* tick the previous stage completed */
+   int               fired;
+   uint64_t          count;
+} piscopeSequence_t;
+
+typedef struct
+{
+   int64_t start;   /* sample numbers */
+   int64_t trigger;
+   int64_t end;
+} piscopeWindow_t;
+
+/*
+The trigger engine holds the triggers followed by the counters, entry
+t being bit t of a match.  For each byte of a level, and each value of
+that byte, level[][] has the entries whose level condition holds on
+that byte and changed[][] likewise for the changed gpios.  A level is
+matched against every entry at once by ANDing eight lookups.
+*/
+
+typedef struct
+{
+   uint64_t level[4][256];
+   uint64_t changed[4][256];
+} piscopeEngine_t;
+
+typedef struct
+{
+   int64_t  high;      /* tick wraps so far, in the upper 32 bits */
+   uint32_t lastTick;
+   uint32_t lastLevel;
+   int64_t  lastEdge[PISCOPE_GPIOS];
+   int64_t  prevTick;
+   int64_t  idleTick;  /* newest report at the last idle check */
+   uint16_t seq;       /* seqno expected next */
+   int      gap;       /* reports lost since the last stored sample */
+   uint64_t lost;
+   uint64_t gaps;
+   uint64_t watchdogs;
+   uint64_t alives;
+} piscopeIngest_t;
+
+typedef int (*piscopeKernel_t)
+   (const gpioReport_t *report, int count, piscopeIngest_t *in,
+    int64_t *tick, uint32_t *level);
+
 /* GLOBALS ---------------------------------------------------------------- */
 
 static gpioReport_t   gReport[PISCOPE_MAX_REPORTS_PER_READ];
 
+/* capture thread -> UI single-producer/single-consumer ring */
+
+static gpioReport_t   gCapRing[PISCOPE_CAPTURE_REPORTS];
+static volatile gint  gCapHead; /* only written by the capture thread */
+static volatile gint  gCapTail; /* only written by the UI thread */
+static volatile gint  gCapRun;
+static volatile gint  gCapStalls; /* times the ring was found full */
+static GThread       *gCapThread;
+static uint64_t       gCapArrival; /* tick and monotonic micros of the
+                                      newest report read, when tracing */
+
 static int            gDebugLevel = 0;
 
+static int            gReportsPerCycle = 2000;
+
 static uint32_t       gTimeSlotMicros;
 static uint32_t       gInputUpdateHz  = 40;
-static uint32_t       gOutputUpdateHz = 20;
+static uint32_t       gOutputUpdateHz = PISCOPE_DEF_FRAME_RATE;
 static int64_t        gRefreshTicks;
+static int            gFrameMicros;  /* between frames at gOutputUpdateHz */
+static gint64         gFrameLast;    /* frame clock time of the last frame */
+static gint64         gFrameDue;     /* frame clock time of the next frame */
+static int            gFrameElapsed; /* micros since the frame before */
+static int            gFrameInput;   /* micros of input since the last frame */
+static int            gFrameLoad;    /* micros of input and display */
+static int            gFrameCoarse;  /* frames left at reduced detail */
 static int32_t        gPlaySpeed = PISCOPE_DEF_SPEED_IDX;
 
 static struct timeval gTimeOrigin;
@@ -222,18 +565,36 @@ static uint32_t       gHilitGpios;
 
 static int            gTriggerFired;
 static int            gTriggerCount;
+static int64_t        gTriggerSample;   /* first firing in this window */
+static int            gTriggerPre;      /* samples kept before it */
 
-static int64_t        gSampleTick[PISCOPE_SAMPLES];
-static uint32_t       gSampleLevel[PISCOPE_SAMPLES];
+static piscopeWindow_t gWindow[PISCOPE_MAX_WINDOWS];
+static int            gWindows;         /* windows captured */
+static int            gWindowShown = -1;
 
-static piscopeState_t gInputState  = piscope_initialise;
-static piscopeState_t gOutputState = piscope_initialise;
+static int64_t        gLockTick;        /* trigger the live view is locked to */
+static int64_t        gLockPending;     /* trigger still being acquired */
+static uint64_t       gTrigHits;        /* reports matching any trigger */
+
+static piscopeIngest_t gIngest;
+
+static piscopeStore_t gStore;
+static piscopeStore_t gSnap;            /* frozen while not live */
+static piscopeStore_t *gView = &gStore; /* the samples displayed */
+
+static int            gPyrOffset[PISCOPE_PYR_LEVELS+1]=
+{
+   0, 0, 4096, 4096+256, 4096+256+16
+};
 
-static int            gBufReadPos;
+/* per pixel column results of the last display scan */
 
-static int            gBufWritePos;
+static uint32_t      *gColEdges;
+static uint32_t      *gColLevel;
+static int            gColAlloc;
 
-static int            gBufSamples;
+static piscopeState_t gInputState  = piscope_initialise;
+static piscopeState_t gOutputState = piscope_initialise;
 
 static int            gGpioTempDisplay[PISCOPE_GPIOS];
 
@@ -265,8 +626,8 @@ static int64_t        gLastReportTick;
 
 static int64_t        gViewTicks;
 
-static int            gViewStartSample;
-static int            gViewEndSample;
+static int64_t        gViewStartSample;
+static int64_t        gViewEndSample;
 
 static int            gTriggerNum = 0;
 
@@ -294,6 +655,8 @@ static GtkWidget        *gMainCmode;
 static GtkWidget        *gMainLtime;
 static GtkWidget        *gMainLmode;
 static GtkWidget        *gMainLtrigs;
+static GtkWidget        *gMainLrate;
+static GtkWidget        *gMainLloss;
 static GtkWidget        *gMainLgold;
 static GtkWidget        *gMainLblue;
 
@@ -307,17 +670,26 @@ static GtkWidget        *gTrigDialog;
 static GtkWidget        *gTrgsDialog;
 
 static GtkWidget        *gTrigLabel;
+static GtkWidget        *gTrigMicros;
 static GtkWidget        *gTrgsSamples;
+static GtkWidget        *gTrgsWindows;
+static GtkWidget        *gTrgsRepeat;
+static GtkWidget        *gTrgsHoldoff;
 
 static GtkWidget        *gMainTBconnect;
 
 static GtkWidget        *gCmdsPlayspeed;
 static GtkWidget        *gCmdsPigpioAddr;
 static GtkWidget        *gCmdsPigpioPort;
+static GtkWidget        *gCmdsBufferMB;
+static GtkWidget        *gCmdsFrameRate;
+static GtkWidget        *gCmdsCaptureFile;
+static GtkWidget        *gCmdsCaptureMB;
 
 static char             *gTrigTypeText[]=
 {
    "-", "Low", "High", "Edge", "Falling", "Rising",
+   "High>T", "High<T", "Low>T", "Low<T", "Idle>T", "Runt<T",
 };
 
 static char              *gTrigWhenText[]=
@@ -332,6 +704,21 @@ static char              *gTrigSamplesText[]=
 
 static int                gTrigSamples;
 
+static char              *gTrigWindowsText[]=
+{
+   "1", "2", "5", "10", "20", "50", "100",
+};
+
+static int                gTrigWindows = 1;
+
+static char              *gTrigRepeatText[]=
+{
+   "single", "normal", "auto",
+};
+
+static piscopeTrigRepeat_t gTrigRepeat;
+static int                gTrigHoldoff;
+
 static GtkComboBoxText   *gTrigCombo[PISCOPE_GPIOS];
 
 static piscopeGpioUsage_t gGpioUsage[][PISCOPE_GPIOS]=
@@ -364,6 +751,13 @@ static piscopeGpioUsage_t gGpioUsage[][PISCOPE_GPIOS]=
 
 static piscopeTrigInfo_t gTrigInfo[PISCOPE_TRIGGERS];
 
+static piscopeEngine_t   gEngine;
+static uint32_t          gIdleTriggers; /* those matched by engine_idle */
+
+static uint64_t          gCounterCount[PISCOPE_COUNTERS];
+
+static piscopeSequence_t gSequence[PISCOPE_SEQUENCES];
+
 static piscopeGpioInfo_t gGpioInfo[PISCOPE_GPIOS];
 
 static int               gDisplayedGpios = PISCOPE_GPIOS;
@@ -371,6 +765,14 @@ static int               gDisplayedGpios = PISCOPE_GPIOS;
 static piscopeMode_t     gMode = piscope_live;
 
 static cairo_surface_t  *gCoscSurface  = NULL;
+static cairo_surface_t  *gWaveSurface  = NULL; /* waveforms without markers */
+static cairo_t          *gWaveCairo    = NULL;
+static int               gWaveValid;
+static int64_t           gWaveStartTick;
+static int64_t           gWaveFirst;
+static uint32_t          gWaveDeciMicroPerPix;
+static int               gWaveMinLevel; /* pyramid level scanned down to */
+static int               gTileGen;      /* older tiles are stale */
 static cairo_surface_t  *gChlegSurface = NULL;
 static cairo_surface_t  *gCvlegSurface = NULL;
 static cairo_surface_t  *gCsampSurface = NULL;
@@ -388,6 +790,8 @@ gboolean main_osc_configure_event
 );
 
 void main_util_setWindowTitle();
+static void main_util_frameRate(int rate);
+static void store_setView(int frozen);
 
 /* FUNCTIONS -------------------------------------------------------------- */
 
@@ -587,6 +991,10 @@ static void util_trig_activate(int trigger)
          GTK_COMBO_BOX(gTrigCombo[i]), gTrigInfo[gTriggerNum-1].type[i]);
    }
 
+   sprintf(label, "%d", gSettings.triggers[gTriggerNum-1].micros);
+
+   gtk_entry_set_text(GTK_ENTRY(gTrigMicros), label);
+
    gtk_widget_show(gTrigDialog);
 }
 
@@ -623,6 +1031,34 @@ static void util_labelText(GtkWidget *label, char *text)
    gtk_label_set_text((GtkLabel*)label, text);
 }
 
+/*
+For figures shown once a second.  Returns the seconds since *last, and
+moves *last on, once a second has passed, otherwise 0.  A *last of 0
+starts the timing and returns -1, for the caller to take its counts.
+*/
+
+static double util_everySecond(gint64 *last)
+{
+   gint64 now;
+   double secs;
+
+   now = g_get_monotonic_time();
+
+   if (!*last)
+   {
+      *last = now;
+      return -1.0;
+   }
+
+   if ((now - *last) < PISCOPE_MILLION) return 0.0;
+
+   secs = (now - *last) / (double)PISCOPE_MILLION;
+
+   *last = now;
+
+   return secs;
+}
+
 static const char *util_playSpeedStr(int speed)
 {
    static char buf[16];
@@ -662,6 +1098,9 @@ static void util_calcGpioY(void)
       }
    }
 
+   gWaveValid = 0;
+   gTileGen++;
+
    util_vlegConfigure(gMainCvleg);
 
    gtk_widget_queue_draw(gMainCvleg);
@@ -676,6 +1115,11 @@ static void util_setViewMode(int mode)
 
    gMode = mode;
 
+   /* freeze the samples displayed while not live */
+
+   if ((mode == piscope_live) != (gView == &gStore))
+      store_setView(mode != piscope_live);
+
    util_mode_display();
 
    switch(mode)
@@ -799,1604 +1243,5322 @@ static char *util_timeStamp(int64_t *tick, int decimals, int blue)
    return buf;
 }
 
-/* PIGPIO ----------------------------------------------------------------- */
-
-static int pigpioCommand(int fd, int command, int p1, int p2)
+static void util_compileGPIOTypes
+(
+   const gint *types,
+   uint32_t   *levelMaskP,
+   uint32_t   *levelValueP,
+   uint32_t   *changedMaskP
+)
 {
-   cmdCmd_t cmd;
+   int i;
+   uint32_t levelMask;
+   uint32_t changedMask;
+   uint32_t levelValue;
 
-   if (fd < 0) return piscope_bad_socket;
+   levelMask    = 0;
+   levelValue   = 0;
+   changedMask  = 0;
 
-   cmd.cmd = command;
-   cmd.p1  = p1;
-   cmd.p2  = p2;
-   cmd.res = 0;
+   for (i=0; i<PISCOPE_GPIOS; i++)
+   {
+      switch (types[i])
+      {
+         case piscope_dont_care:
+            break;
 
-   if (send(fd, &cmd, sizeof(cmdCmd_t), 0) != sizeof(cmdCmd_t))
-      return piscope_bad_send;
+         case piscope_low:
+            levelMask |= (1<<i);
+            break;
 
-   if (recv(fd, &cmd, sizeof(cmdCmd_t), MSG_WAITALL) != sizeof(cmdCmd_t))
-      return piscope_bad_recv;
+         case piscope_high:
+            levelMask  |= (1<<i);
+            levelValue |= (1<<i);
+            break;
 
-   return cmd.res;
-}
+         case piscope_edge:
+            changedMask |= (1<<i);
+            break;
 
-static void pigpioSetAddr(void)
-{
-   char * portStr, * addrStr;
-   char buf[16];
+         case piscope_falling:
+            levelMask   |= (1<<i);
+            changedMask |= (1<<i);
+            break;
 
-   portStr = getenv(PI_ENVPORT);
+         case piscope_rising:
+         case piscope_low_gt:  /* ends on a rising edge */
+         case piscope_low_lt:
+            levelMask   |= (1<<i);
+            levelValue  |= (1<<i);
+            changedMask |= (1<<i);
+            break;
 
-   if ((!portStr) || (!strlen(portStr)))
-   {
-      sprintf(buf, "%d", gSettings.port);
-      portStr = buf;
-   }
+         case piscope_high_gt: /* ends on a falling edge */
+         case piscope_high_lt:
+            levelMask   |= (1<<i);
+            changedMask |= (1<<i);
+            break;
 
-   addrStr = getenv(PI_ENVADDR);
+         case piscope_runt_lt:
+            changedMask |= (1<<i);
+            break;
 
-   if ((!addrStr) || (!strlen(addrStr)))
-   {
-      addrStr=gSettings.serverAddress;
+         case piscope_idle_gt:
+            break;
+      }
    }
 
-   gtk_entry_set_text(GTK_ENTRY(gCmdsPigpioAddr), addrStr);
-
-   gtk_entry_set_text(GTK_ENTRY(gCmdsPigpioPort), portStr);
+   *levelMaskP   = levelMask;
+   *levelValueP  = levelValue;
+   *changedMaskP = changedMask;
 }
 
-static void pigpioLoadSettings(void)
+/* STORE ------------------------------------------------------------------ */
+
+static __thread piscopeUnpacked_t gUnpacked; /* one per thread */
+
+static uint8_t gPackBuf[PISCOPE_SEG_SAMPLES * 15];
+
+static inline piscopeSegment_t *store_seg(piscopeStore_t *st, int64_t n)
 {
-   GKeyFile *cfg;
-   char *file, buf[50];
-   gint *tempList;
-   gboolean loaded;
-   int i, j;
-   gsize len;
+   int slot;
 
-   cfg = g_key_file_new();
-   file = g_build_filename(g_get_user_config_dir(), SETTINGS_FILE_NAME, NULL);
+   slot = st->headSeg + (int)((n >> PISCOPE_SEG_SHIFT) - st->firstSeg);
 
-   loaded = g_key_file_load_from_file(cfg, file, G_KEY_FILE_NONE, NULL);
+   if (slot >= st->maxSegs) slot -= st->maxSegs;
 
-   g_free(gSettings.serverAddress);
-   g_free(gSettings.activeGPIOs);
-   gSettings.serverAddress=NULL;
-   gSettings.activeGPIOs=NULL;
-   gSettings.activeGPIOCount=0;
+   return st->seg[slot];
+}
 
-   if(loaded)
+static void store_unpackBlock
+   (piscopePacked_t *pk, int block, int64_t *tick, uint32_t *level)
+{
+   uint8_t *p;
+   uint64_t delta;
+   uint32_t mask;
+   int i, shift, code;
+
+   p = pk->data + pk->pos[block];
+
+   tick[0]  = pk->first[block];
+   level[0] = pk->level[block];
+
+   for (i=1; i<PISCOPE_BLOCK_SAMPLES; i++)
    {
-      gSettings.serverAddress = g_key_file_get_string(cfg, SETTINGS_GROUP, SETTINGS_SERVER_ADDRESS, NULL);
-      gSettings.activeGPIOs = g_key_file_get_integer_list (cfg, SETTINGS_GROUP, SETTINGS_ACTIVE_GPIOS, &gSettings.activeGPIOCount, NULL);
-      gSettings.port = g_key_file_get_integer(cfg, SETTINGS_GROUP, SETTINGS_SERVER_PORT, NULL);
-      gSettings.triggerSamples = g_key_file_get_integer(cfg, SETTINGS_GROUP, SETTINGS_TRIGGER_SAMPLES, NULL);
-      for(i=0; i<PISCOPE_TRIGGERS; i++)
-         {
-            sprintf(buf, SETTINGS_TRIGGER_ENABLED, i+1);
-            gSettings.triggers[i].enabled = g_key_file_get_boolean(cfg, SETTINGS_GROUP, buf, NULL);
-            sprintf(buf, SETTINGS_TRIGGER_ACTION, i+1);
-            gSettings.triggers[i].action = g_key_file_get_integer(cfg, SETTINGS_GROUP, buf, NULL);
-            sprintf(buf, SETTINGS_TRIGGER_GPIO_TYPES, i+1);
-            tempList = g_key_file_get_integer_list(cfg, SETTINGS_GROUP, buf, &len, NULL);
-            if(tempList)
-               {
-                  for(j=0; j<len && j<PISCOPE_GPIOS; j++)
-                     {
-                        gSettings.triggers[i].gpiotypes[j] = tempList[j];
-                     }
-               }
-            g_free(tempList);
-         }
+      delta = 0;
+      shift = 0;
+
+      do
+      {
+         delta |= (uint64_t)(*p & 0x7F) << shift;
+         shift += 7;
+      }
+      while (*p++ & 0x80);
+
+      code = *p++;
+
+      if      (code <  PISCOPE_PACK_MASK) mask = 1 << code;
+      else if (code == PISCOPE_PACK_MASK) {memcpy(&mask, p, 4); p += 4;}
+      else                                mask = 0;
+
+      tick[i]  = tick[i-1] + delta;
+      level[i] = level[i-1] ^ mask;
    }
+}
 
-   if(!gSettings.serverAddress)
+static piscopeUnpacked_t *store_unpacked(piscopePacked_t *pk, int offset)
+{
+   int block;
+
+   block = offset >> PISCOPE_BLOCK_SHIFT;
+
+   if ((gUnpacked.packed != pk) || (gUnpacked.block != block))
    {
-      gSettings.serverAddress = g_malloc(sizeof(PI_DEFAULT_SERVER_ADDRESS));
-      strcpy (gSettings.serverAddress, PI_DEFAULT_SERVER_ADDRESS);
-      gSettings.port = PI_DEFAULT_SOCKET_PORT;
+      store_unpackBlock(pk, block, gUnpacked.tick, gUnpacked.level);
+
+      gUnpacked.packed = pk;
+      gUnpacked.block  = block;
    }
 
-   g_free(file);
-   g_key_file_free(cfg);
+   return &gUnpacked;
 }
 
-static void pigpioSaveSettings(void)
+static inline int64_t store_segTick(piscopeSegment_t *seg, int offset)
 {
-   GKeyFile * cfg;
-   char * file, buf[50];
-   int i;
-
-   cfg = g_key_file_new();
-   file = g_build_filename(g_get_user_config_dir(), SETTINGS_FILE_NAME, NULL);
-
-   g_key_file_set_string(cfg, SETTINGS_GROUP, SETTINGS_SERVER_ADDRESS, gSettings.serverAddress);
-   g_key_file_set_integer(cfg, SETTINGS_GROUP, SETTINGS_SERVER_PORT, gSettings.port);
-   if(gSettings.activeGPIOs)
-      g_key_file_set_integer_list(cfg, SETTINGS_GROUP, SETTINGS_ACTIVE_GPIOS, gSettings.activeGPIOs, gSettings.activeGPIOCount);
-
-   g_key_file_set_integer(cfg, SETTINGS_GROUP, SETTINGS_TRIGGER_SAMPLES, gSettings.triggerSamples);
-   for(i=0; i<PISCOPE_TRIGGERS; i++)
-      {
-         sprintf(buf, SETTINGS_TRIGGER_ENABLED, i+1);
-         g_key_file_set_boolean(cfg, SETTINGS_GROUP, buf, gSettings.triggers[i].enabled);
-         sprintf(buf, SETTINGS_TRIGGER_ACTION, i+1);
-         g_key_file_set_integer(cfg, SETTINGS_GROUP, buf, gSettings.triggers[i].action);
-         sprintf(buf, SETTINGS_TRIGGER_GPIO_TYPES, i+1);
-         g_key_file_set_integer_list(cfg, SETTINGS_GROUP, buf, gSettings.triggers[i].gpiotypes, PISCOPE_GPIOS);
-      }
-   g_key_file_save_to_file(cfg, file, NULL);
+   if (seg->raw) return seg->raw->tick[offset];
 
-   g_free(file);
-   g_key_file_free(cfg);
-}
+   if (!(offset & (PISCOPE_BLOCK_SAMPLES-1)))
+      return seg->packed->first[offset >> PISCOPE_BLOCK_SHIFT];
 
-static int cmpfunc(const void * a, const void * b) {
-   return ( *(int*)a - *(int*)b );
+   return store_unpacked(seg->packed, offset)->
+      tick[offset & (PISCOPE_BLOCK_SAMPLES-1)];
 }
 
-static void pigpioSetGpios(void)
+static inline uint32_t store_segLevel(piscopeSegment_t *seg, int offset)
 {
-   int i, hwver;
-   uint32_t notifyBits = 0;
+   if (seg->raw) return seg->raw->level[offset];
 
-   gDisplayedGpios = 0;
-
-   hwver = pigpioCommand(gPigSocket, PI_CMD_HWVER, 0, 0);
-
-   if      (hwver <  0) gRPiRevision = 0;
-   else if (hwver <  4) gRPiRevision = 1;
-   else if (hwver < 16) gRPiRevision = 2;
-   else                 gRPiRevision = 3;
+   if (!(offset & (PISCOPE_BLOCK_SAMPLES-1)))
+      return seg->packed->level[offset >> PISCOPE_BLOCK_SHIFT];
 
-   for (i=0; i<PISCOPE_GPIOS; i++)
-   {
-      gGpioInfo[i].display = 0;
+   return store_unpacked(seg->packed, offset)->
+      level[offset & (PISCOPE_BLOCK_SAMPLES-1)];
+}
 
-      switch (gRPiRevision)
-      {
-         case 1:
-         case 2:
-         case 3:
-            gGpioInfo[i].name = gGpioUsage[gRPiRevision-1][i].name;
+/* tick of the last sample of an aligned bucket of size samples */
 
-            if (gGpioUsage[gRPiRevision-1][i].usable && (!gSettings.activeGPIOs ||
-                  bsearch(&i, gSettings.activeGPIOs, gSettings.activeGPIOCount, sizeof (int), cmpfunc)))
-               gGpioInfo[i].display = 1;
+static inline int64_t store_segLastTick
+   (piscopeSegment_t *seg, int offset, int size)
+{
+   if ((size >= PISCOPE_BLOCK_SAMPLES) && !seg->raw)
+      return seg->packed->last[(offset+size-1) >> PISCOPE_BLOCK_SHIFT];
 
-            break;
+   return store_segTick(seg, offset+size-1);
+}
 
-         default:
-            gGpioInfo[i].name = NULL;
-            gGpioInfo[i].display = 1;
-      }
+/* level of the last sample of an aligned bucket of size samples */
 
-      if (gGpioInfo[i].display)
-      {
-         gDisplayedGpios++;
-         notifyBits |= (1<<i);
-      }
+static inline uint32_t store_segLastLevel
+   (piscopeSegment_t *seg, int offset, int size)
+{
+   if ((size >= PISCOPE_BLOCK_SAMPLES) && !seg->raw)
+      return seg->packed->lastLevel[(offset+size-1) >> PISCOPE_BLOCK_SHIFT];
 
-      gtk_toggle_button_set_active(
-         gGpioInfo[i].button, gGpioInfo[i].display);
-   }
+   return store_segLevel(seg, offset+size-1);
+}
 
-   pigpioCommand(gPigSocket, PI_CMD_NB, gPigHandle, notifyBits);
+static inline int64_t store_tick(piscopeStore_t *st, int64_t n)
+{
+   return store_segTick(store_seg(st, n), n & (PISCOPE_SEG_SAMPLES-1));
 }
 
-static void util_setTriggerGPIOTypes(int triggerNum)
+static inline uint32_t store_level(piscopeStore_t *st, int64_t n)
 {
-   int i, v;
-   uint32_t levelMask;
-   uint32_t changedMask;
-   uint32_t levelValue;
+   return store_segLevel(store_seg(st, n), n & (PISCOPE_SEG_SAMPLES-1));
+}
 
-   levelMask    = 0;
-   levelValue   = 0;
-   changedMask  = 0;
+/* an estimate of how many samples the store can hold */
 
-   for (i=0; i<PISCOPE_GPIOS; i++)
-   {
-      v = gSettings.triggers[triggerNum].gpiotypes[i];
-      gTrigInfo[triggerNum].type[i] = v;
+static int64_t store_capacity(piscopeStore_t *st)
+{
+   int64_t capacity;
 
-      switch (v)
-      {
-         case piscope_dont_care:
-            break;
+   if (!st->budget) return (st->next > st->first) ? st->next - st->first : 1;
 
-         case piscope_low:
-            levelMask |= (1<<i);
-            break;
+   capacity = (int64_t)st->maxSegs << PISCOPE_SEG_SHIFT;
 
-         case piscope_high:
-            levelMask  |= (1<<i);
-            levelValue |= (1<<i);
-            break;
+   if (!st->map && (st->bytes > st->budget/8))
+   {
+      /* scale by how well the samples so far have packed */
 
-         case piscope_edge:
-            changedMask |= (1<<i);
-            break;
+      capacity = (double)(st->next - st->first) * st->budget / st->bytes;
+   }
 
-         case piscope_falling:
-            levelMask   |= (1<<i);
-            changedMask |= (1<<i);
-            break;
+   if (capacity < (st->next - st->first)) capacity = st->next - st->first;
 
-         case piscope_rising:
-            levelMask   |= (1<<i);
-            levelValue  |= (1<<i);
-            changedMask |= (1<<i);
-            break;
-      }
-   }
+   if (capacity < 1) capacity = 1;
 
-   gTrigInfo[triggerNum].levelMask = levelMask;
-   gTrigInfo[triggerNum].levelValue = levelValue;
-   gTrigInfo[triggerNum].changedMask = changedMask;
+   return capacity;
 }
 
-static void pigpioSetTriggers(void)
+static void store_releaseRaw(piscopeStore_t *st, piscopeSegment_t *seg)
 {
-   int i;
-
-   sscanf(gTrigSamplesText[gSettings.triggerSamples], "%d", &gTrigSamples);
-   gtk_combo_box_set_active(GTK_COMBO_BOX(gTrgsSamples),  gSettings.triggerSamples);
+   st->bytes -= sizeof(piscopeRaw_t);
 
-   for(i=0; i<PISCOPE_TRIGGERS; i++)
-   {
-      gTrigInfo[i].enabled = gSettings.triggers[i].enabled;
-      gTrigInfo[i].when = gSettings.triggers[i].action;
-      util_setTriggerGPIOTypes(i);
+   if (st->spare) g_free(seg->raw); else st->spare = seg->raw;
 
-      gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(gTrigInfo[i].onW), gTrigInfo[i].enabled);
-      gtk_combo_box_set_active(GTK_COMBO_BOX(gTrigInfo[i].whenW), gTrigInfo[i].when);
-   }
+   seg->raw = NULL;
 }
 
-static void pigpioSetState(void)
+static void store_release(piscopeStore_t *st, piscopeSegment_t *seg)
 {
-   if (gPigConnected)
-   {
-      gtk_toggle_tool_button_set_active(
-         GTK_TOGGLE_TOOL_BUTTON(gMainTBconnect), TRUE);
+   int g;
 
-      gtk_toggle_tool_button_set_active(
-         GTK_TOGGLE_TOOL_BUTTON(gMainTBlive), TRUE);
-   }
-   else
+   for (g=0; g<PISCOPE_GPIOS; g++)
    {
-      gtk_toggle_tool_button_set_active(
-         GTK_TOGGLE_TOOL_BUTTON(gMainTBconnect), FALSE);
+      st->bytes -= seg->edgeAlloc[g] * sizeof(uint16_t);
 
-      gtk_toggle_tool_button_set_active(
-         GTK_TOGGLE_TOOL_BUTTON(gMainTBpause), TRUE);
+      g_free(seg->edge[g]);
+
+      seg->edge[g]      = NULL;
+      seg->edges[g]     = 0;
+      seg->edgeAlloc[g] = 0;
    }
 
-   main_util_setWindowTitle();
-   
-   util_zoom_def_clicked();
-}
+   st->bytes -= seg->hitAlloc * sizeof(uint16_t);
 
-static int pigpioOpenSocket(void)
-{
-   int sock, err;
-   struct addrinfo hints, *res, *rp;
-   const gchar *addrStr, *portStr;
+   g_free(seg->hit);
 
-   addrStr = gtk_entry_get_text(GTK_ENTRY(gCmdsPigpioAddr));
+   seg->hit      = NULL;
+   seg->hits     = 0;
+   seg->hitAlloc = 0;
 
-   portStr = gtk_entry_get_text(GTK_ENTRY(gCmdsPigpioPort));
+   st->bytes -= seg->gapAlloc * sizeof(uint16_t);
 
-   memset (&hints, 0, sizeof (hints));
+   g_free(seg->gap);
 
-   hints.ai_family   = PF_UNSPEC;
-   hints.ai_socktype = SOCK_STREAM;
-   hints.ai_flags   |= AI_CANONNAME;
+   seg->gap      = NULL;
+   seg->gaps     = 0;
+   seg->gapAlloc = 0;
 
-   err = getaddrinfo (addrStr, portStr, &hints, &res);
+   if (st->map) return;
 
-   if (err) return piscope_bad_getaddrinfo;
+   if (seg->raw) store_releaseRaw(st, seg);
 
-   for (rp=res; rp!=NULL; rp=rp->ai_next)
+   if (seg->packed)
    {
-      sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+      st->bytes -= sizeof(piscopePacked_t) + seg->packed->bytes;
 
-      if (sock == -1) continue;
+      if (gUnpacked.packed == seg->packed) gUnpacked.packed = NULL;
 
-      if (connect(sock, rp->ai_addr, rp->ai_addrlen) != -1) break;
+      g_free(seg->packed);
    }
 
-   freeaddrinfo(res);
-
-   if (rp == NULL) return piscope_bad_connect;
-
-   return sock;
+   seg->raw    = NULL;
+   seg->packed = NULL;
+   seg->pyr    = NULL;
 }
 
-static int pigpioOpenNotifications(void)
-{
-   int r;
+/* the bytes a segment adds to st->bytes */
 
-   gPigNotify = pigpioOpenSocket();
+static int64_t store_segBytes(piscopeStore_t *st, piscopeSegment_t *seg)
+{
+   int64_t bytes;
+   int g;
 
-   if (gPigNotify < 0) return piscope_bad_nsock;
+   bytes = (seg->hitAlloc + seg->gapAlloc) * sizeof(uint16_t);
 
-   r = pigpioCommand(gPigNotify, PI_CMD_NOIB, 0, 0);
+   for (g=0; g<PISCOPE_GPIOS; g++) bytes += seg->edgeAlloc[g] * sizeof(uint16_t);
 
-   if (r < 0) return piscope_bad_noib;
+   if (seg->packed) bytes += sizeof(piscopePacked_t) + seg->packed->bytes;
 
-   gPigHandle = r;
+   if (seg->raw && !st->map) bytes += sizeof(piscopeRaw_t);
 
-   return 0;
+   return bytes;
 }
 
-static void pigpioConnect(void)
+/* drop the store's hold on the segment in slot */
+
+static void store_detach(piscopeStore_t *st, int slot)
 {
-   char msg[256];
+   piscopeSegment_t *seg;
+   piscopeRaw_t *raw;
 
-   if (!gPigConnected)
+   seg = st->seg[slot];
+
+   if (seg->refs > 1)
    {
-      gBufWritePos   = -1;
-      gBufReadPos    =  0;
-      gBufSamples    =  0;
+      /* a snapshot still holds it */
 
-      gPigSocket = pigpioOpenSocket();
+      st->bytes -= store_segBytes(st, seg);
 
-      if (gPigSocket >= 0)
+      if (st->map && seg->raw)
       {
-         gPigConnected = 1;
+         /* the file slot is about to be reused, copy on write */
 
-         pigpioOpenNotifications();
+         raw = g_malloc(sizeof(piscopeRaw_t));
 
-         gInputState = piscope_initialise;
-      }
-      else
-      {
-         gPigConnected = 0;
+         memcpy(raw, seg->raw, sizeof(piscopeRaw_t));
 
-         snprintf(msg, sizeof(msg),
-            "Can't connect to pigpio at %s.\nDid you sudo pigpiod?\nIf you are on a remote client, have you set the server address and port?",
-             gtk_entry_get_text(GTK_ENTRY(gCmdsPigpioAddr)));
-         
-         util_popupMessage(GTK_MESSAGE_WARNING, GTK_BUTTONS_CLOSE, msg);
+         seg->raw = raw;
+         seg->pyr = raw->pyr;
       }
 
-      pigpioSetGpios();
+      seg->refs--;
 
-      pigpioSetTriggers();
+      st->seg[slot] = NULL;
+   }
+   else store_release(st, seg);
+}
 
-      pigpioSetState();
+static void store_reset(piscopeStore_t *st)
+{
+   int i;
 
-      util_calcGpioY();
+   for (i=0; i<st->maxSegs; i++)
+   {
+      if (st->seg[i]) store_detach(st, i);
    }
+
+   st->numSegs  = 0;
+   st->headSeg  = 0;
+   st->firstSeg = 0;
+   st->first    = 0;
+   st->next     = 0;
+
+   gWaveValid = 0;
+   gTileGen++;
 }
 
-static void pigpioDisconnect(void)
+static void store_free(piscopeStore_t *st)
 {
-   if (gPigConnected)
+   int i;
+
+   store_reset(st);
+
+   for (i=0; i<st->maxSegs; i++) g_free(st->seg[i]);
+
+   g_free(st->seg);
+   g_free(st->spare);
+
+   if (st->map) munmap(st->map, st->mapBytes);
+
+   st->seg     = NULL;
+   st->spare   = NULL;
+   st->map     = NULL;
+   st->maxSegs = 0;
+   st->bytes   = 0;
+}
+
+/*
+Size the store from a memory budget, or, if filename is given, back
+every segment with a preallocated file of that size which is memory
+mapped.  Returns 0 or an errno, in which case the store is left empty.
+*/
+
+static int store_init(piscopeStore_t *st, int megabytes, const char *filename)
+{
+   int64_t segs;
+   int i, fd, err;
+
+   store_free(st);
+
+   st->budget = (int64_t)megabytes << 20;
+
+   if (filename && filename[0])
    {
-      gInputState = piscope_dormant;
+      /* file backed segments stay raw */
 
-      gPigConnected = 0;
+      segs = st->budget / sizeof(piscopeRaw_t);
 
-      if (gPigSocket >= 0)
+      if (segs < 2) segs = 2;
+
+      st->mapBytes = segs * sizeof(piscopeRaw_t);
+
+      fd = open(filename, O_RDWR|O_CREAT, 0644);
+
+      if (fd < 0) return errno;
+
+      err = posix_fallocate(fd, 0, st->mapBytes);
+
+      if (!err)
       {
-         if (gPigHandle >= 0)
+         st->map = mmap(NULL, st->mapBytes,
+            PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+
+         if (st->map == MAP_FAILED)
          {
-            pigpioCommand(gPigSocket, PI_CMD_NC, gPigHandle, 0);
-            gPigHandle = -1;
+            err = errno;
+            st->map = NULL;
          }
-
-         close(gPigSocket);
-         gPigSocket = -1;
       }
 
-      if (gPigNotify >= 0)
+      close(fd);
+
+      if (err) return err;
+
+      st->maxSegs = segs;
+
+      st->seg = g_malloc(st->maxSegs * sizeof(piscopeSegment_t *));
+
+      for (i=0; i<st->maxSegs; i++)
       {
-         close(gPigNotify);
-         gPigNotify = -1;
+         st->seg[i] = g_malloc0(sizeof(piscopeSegment_t));
+
+         st->seg[i]->refs = 1;
       }
 
-      pigpioSetGpios();
+      return 0;
+   }
 
-      pigpioSetState();
+   /* enough slots for segments packed to two bytes a sample */
 
-      util_calcGpioY();
-   }
-}
+   segs = st->budget /
+      (sizeof(piscopePacked_t) + (2 * PISCOPE_SEG_SAMPLES));
 
-/* CMDS ------------------------------------------------------------------- */
+   if (segs < 2) segs = 2;
 
-void cmds_clear_triggers_clicked(GtkButton * button, gpointer user_data)
-{
-   int i;
+   st->maxSegs = segs;
 
-   for (i=0; i<PISCOPE_TRIGGERS; i++) gTrigInfo[i].count = 0;
-}
+   /* segments are allocated as they are first needed */
 
-void cmds_close_clicked(GtkButton * button, gpointer user_data)
-{
-   const char *serverAddress;
-   char msg[128];
-   
-   gtk_widget_hide(gCmdsDialog);
-
-   if (gSettings.serverAddress)
-   {
-      g_free(gSettings.serverAddress);
-      gSettings.serverAddress=NULL;
-   }
-   serverAddress = gtk_entry_get_text(GTK_ENTRY(gCmdsPigpioAddr));
-   gSettings.serverAddress = g_malloc(strlen(serverAddress)+1);
-   strcpy(gSettings.serverAddress, serverAddress);
-   gSettings.port = strtol(gtk_entry_get_text(GTK_ENTRY(gCmdsPigpioPort)), NULL, 10);
-   
-   if (!gPigConnected)
-   {
-      snprintf(msg, sizeof(msg), "Connect to pigpio at %s", serverAddress);
-      gtk_widget_set_tooltip_text(GTK_WIDGET(gMainTBconnect), msg);
-   }
+   st->seg = g_malloc0(st->maxSegs * sizeof(piscopeSegment_t *));
 
-   pigpioSaveSettings();
+   return 0;
 }
 
-void cmds_emptybuf_clicked(GtkButton * button, gpointer user_data)
+static void store_pack(piscopeStore_t *st, piscopeSegment_t *seg)
 {
-   if (util_popupMessage(GTK_MESSAGE_QUESTION,
-                    GTK_BUTTONS_YES_NO,
-                    "Clear all samples?") ==  GTK_RESPONSE_YES)
-   {
-      gBufWritePos = -1;
-      gBufReadPos  =  0;
-      gBufSamples  =  0;
+   piscopeRaw_t *raw;
+   piscopePacked_t *pk;
+   uint8_t *p;
+   uint64_t delta;
+   uint32_t changed;
+   int b, i, o;
 
-      gBlueTick = 0;
-      gGoldTick = 0;
-      g1Tick = 0;
-      g2Tick = 0;
+   raw = seg->raw;
 
-      gTickOrigin = 0;
+   p = gPackBuf;
 
-      main_osc_configure_event(gMainCosc, NULL, NULL);
-   }
-}
+   for (o=0; o<PISCOPE_SEG_SAMPLES; o++)
+   {
+      if (!(o & (PISCOPE_BLOCK_SAMPLES-1))) continue; /* in the directory */
 
-void cmds_playspeed_changed(GtkComboBox *widget, gpointer user_data)
-{
-   gPlaySpeed = gtk_combo_box_get_active(widget);
+      delta = raw->tick[o] - raw->tick[o-1];
 
-   if (gMode == piscope_play) util_setViewMode(piscope_play);
-}
+      while (delta >= 0x80)
+      {
+         *p++ = delta | 0x80;
+         delta >>= 7;
+      }
 
-/* FILE ------------------------------------------------------------------- */
+      *p++ = delta;
 
-static int file_VCDsymbol(int bit)
-{
-   if (bit < 26) return ('A' + bit);
-   else          return ('a' + bit - 26);
-}
+      changed = raw->level[o] ^ raw->level[o-1];
 
-static int file_load(char *filename)
-{
-   uint32_t level;
-   int64_t tick64;
-   int index;
-   int err;
-   FILE * in;
-   time_t time;
-   struct tm cal;
-   char buf[512];
+      if (!changed)
+      {
+         *p++ = PISCOPE_PACK_SAME;
+      }
+      else if (!(changed & (changed-1)))
+      {
+         *p++ = __builtin_ctz(changed);
+      }
+      else
+      {
+         *p++ = PISCOPE_PACK_MASK;
+         memcpy(p, &changed, 4);
+         p += 4;
+      }
+   }
 
-   err = 1;
+   if ((sizeof(piscopePacked_t) + (p - gPackBuf)) >= sizeof(piscopeRaw_t))
+      return; /* not worth it */
 
-   in = fopen(filename, "r");
+   pk = g_try_malloc(sizeof(piscopePacked_t) + (p - gPackBuf));
 
-   if (in == NULL) return errno;
+   if (!pk) return;
 
-   if (fgets(buf, 32, in))
-   {
-      if (strcmp(buf, "#piscope\n") == 0)
-      {
-         if (fgets(buf, 64, in))
-         {
-            if (strncmp(buf, "#date ", 6) == 0)
-            {
-               sscanf(buf, "#date %d-%d-%d %d:%d:%d",
-                  &cal.tm_year, &cal.tm_mon, &cal.tm_mday,
-                  &cal.tm_hour, &cal.tm_min, &cal.tm_sec);
+   pk->bytes = p - gPackBuf;
 
-               /* need tm_mon in 0..11 */
-               --cal.tm_mon;
+   memcpy(pk->data, gPackBuf, pk->bytes);
 
-               /* need tm_year from 1900 */
-               cal.tm_year -= 1900;
+   /* fill in the block directory */
 
-               time = mktime(&cal);
+   p = pk->data;
 
-               gTimeOrigin.tv_sec  = time;
-               gTimeOrigin.tv_usec = 0;
+   for (b=0; b<PISCOPE_SEG_BLOCKS; b++)
+   {
+      o = b << PISCOPE_BLOCK_SHIFT;
 
-               gTickOrigin = 0;
-               gGoldTick   = 0;
+      pk->first[b] = raw->tick[o];
+      pk->last[b]  = raw->tick[o + PISCOPE_BLOCK_SAMPLES - 1];
+      pk->level[b] = raw->level[o];
+      pk->pos[b]   = p - pk->data;
 
-               err = 0;
-               index = 0;
+      pk->lastLevel[b] = raw->level[o + PISCOPE_BLOCK_SAMPLES - 1];
 
-               while (fscanf(in, "%Ld %08X\n",
-                        (long long int *) &tick64, &level) == 2)
-               {
-                  if (index < PISCOPE_SAMPLES)
-                  {
-                     gSampleTick[index]  = tick64;
-                     gSampleLevel[index] = level;
-                     ++index;
-                  }
-               }
-               gBufSamples = index;
-               gBufReadPos = 0;
-               gBufWritePos = index -1 ;
-            }
-         }
+      for (i=1; i<PISCOPE_BLOCK_SAMPLES; i++)
+      {
+         while (*p++ & 0x80);
+
+         if (*p++ == PISCOPE_PACK_MASK) p += 4;
       }
    }
 
-   if (err)
-   {
-      util_popupMessage
-      (
-         GTK_MESSAGE_WARNING, GTK_BUTTONS_CLOSE,
-         "%s\nis not a legal .piscope file",
-         filename
-      );
-   }
+   memcpy(pk->pyr, raw->pyr, sizeof(pk->pyr));
 
-   fclose(in);
+   st->bytes += sizeof(piscopePacked_t) + pk->bytes;
 
-   return 0;
+   store_releaseRaw(st, seg);
+
+   seg->packed = pk;
+   seg->pyr    = pk->pyr;
 }
 
-static int file_save(int filetype, char *filename, int selection)
+static void store_pyrUpdate(piscopeSegment_t *seg, int offset, uint32_t changed)
 {
-   int b, r, p, v;
-   uint32_t lastLevel, changed, level;
-   FILE * out;
-
-   out = fopen(filename, "w");
+   int k, shift, node;
 
-   if (out == NULL) return errno;
+   shift = PISCOPE_PYR_SHIFT;
 
-   if (filetype == piscope_vcd)
+   for (k=1; k<=PISCOPE_PYR_LEVELS; k++)
    {
-      fprintf(out, "$date %s $end\n", util_timeStamp(&gTickOrigin, 0, 0));
-      fprintf(out, "$version piscope V1 $end\n");
-      fprintf(out, "$timescale 1 us $end\n");
-      fprintf(out, "$scope module top $end\n");
+      node = gPyrOffset[k] + (offset >> shift);
 
-      for (b=0; b<32; b++)
-         fprintf(out, "$var wire 1 %c %d $end\n", file_VCDsymbol(b), b);
+      if (offset & ((1<<shift)-1)) seg->pyr[node] |= changed;
+      else                         seg->pyr[node]  = changed;
 
-      fprintf(out, "$upscope $end\n");
-      fprintf(out, "$enddefinitions $end\n");
-   }
-   else
-   {
-      fprintf(out, "#piscope\n");
-      fprintf(out, "#date %s\n", util_timeStamp(&gTickOrigin, 0, 0));
+      shift += PISCOPE_PYR_SHIFT;
    }
+}
+
+/* append an offset to a growing list, returns the bytes allocated */
 
-   p = gBufReadPos;
+static int store_listAppend(uint16_t **list, int *used, int *alloc, int offset)
+{
+   int grown;
 
-   lastLevel = ~gSampleLevel[p];
+   grown = 0;
 
-   for (r=0; r<gBufSamples; r++)
+   if (*used == *alloc)
    {
-      if (!selection ||
-        ((gSampleTick[p] >= g1Tick) && (gSampleTick[p] <= g2Tick)))
-      {
-         if (filetype == piscope_vcd)
-         {
-            fprintf(out, "#%Ld\n",
-               (long long int)(gSampleTick[p]-gTickOrigin));
+      if (*alloc) grown = *alloc; else grown = PISCOPE_EDGE_ALLOC;
 
-            level = gSampleLevel[p];
+      *alloc += grown;
 
-            changed = level ^ lastLevel;
+      *list = g_realloc(*list, (*alloc) * sizeof(uint16_t));
+   }
 
-            for (b=0; b<32; b++)
-            {
-               if (changed & (1<<b))
-               {
-                  if (level & (1<<b)) v='1'; else v='0';
+   (*list)[(*used)++] = offset;
 
-                  fprintf(out, "%c%c\n", v, file_VCDsymbol(b));
-               }
-            }
+   return grown * sizeof(uint16_t);
+}
 
-            lastLevel = gSampleLevel[p];
-         }
-         else
-         {
-            fprintf
-            (
-               out,
-               "%Ld %08X\n",
-               (long long int)(gSampleTick[p]-gTickOrigin),
-               gSampleLevel[p]
-            );
-         }
-      }
+static void store_edgeUpdate
+   (piscopeStore_t *st, piscopeSegment_t *seg, int offset, uint32_t changed)
+{
+   int g;
 
-      if (++p >= PISCOPE_SAMPLES) p = 0;
-   }
+   while (changed)
+   {
+      g = __builtin_ctz(changed);
 
-   fclose(out);
+      changed &= (changed - 1);
 
-   return 0;
+      st->bytes += store_listAppend
+         (&seg->edge[g], &seg->edges[g], &seg->edgeAlloc[g], offset);
+   }
 }
 
-/* GPIO ------------------------------------------------------------------- */
-
-void gpio_clear_all(GtkButton * button, gpointer user_data)
+static void store_hitAppend(piscopeStore_t *st, int64_t n)
 {
-   int i;
-   /* clear states */
-   for (i=0; i<PISCOPE_GPIOS; i++)
-   {
-      gtk_toggle_button_set_active(gGpioInfo[i].button, FALSE);
-   }
+   piscopeSegment_t *seg;
+
+   seg = store_seg(st, n);
+
+   st->bytes += store_listAppend(&seg->hit, &seg->hits, &seg->hitAlloc,
+      n & (PISCOPE_SEG_SAMPLES-1));
 }
 
-void gpio_set_all(GtkButton * button, gpointer user_data)
+static void store_gapAppend(piscopeStore_t *st, int64_t n)
 {
-   int i;
-   /* set states */
-   for (i=0; i<PISCOPE_GPIOS; i++)
-   {
-      gtk_toggle_button_set_active(gGpioInfo[i].button, TRUE);
-   }
+   piscopeSegment_t *seg;
+
+   seg = store_seg(st, n);
+
+   st->bytes += store_listAppend(&seg->gap, &seg->gaps, &seg->gapAlloc,
+      n & (PISCOPE_SEG_SAMPLES-1));
 }
 
-void gpio_invert_all(GtkButton * button, gpointer user_data)
+/* index of the first entry of the sorted list at or after offset */
+
+static int store_edgeBsearch(uint16_t *edge, int edges, int offset)
 {
-   int i;
-   /* invert states */
-   for (i=0; i<PISCOPE_GPIOS; i++)
+   int lo, hi, mid;
+
+   lo = 0;
+   hi = edges;
+
+   while (lo < hi)
    {
-      if (gtk_toggle_button_get_active(gGpioInfo[i].button))
-         gtk_toggle_button_set_active(gGpioInfo[i].button, FALSE);
-      else
-         gtk_toggle_button_set_active(gGpioInfo[i].button, TRUE);      
+      mid = (lo + hi) / 2;
+
+      if (edge[mid] < offset) lo = mid + 1; else hi = mid;
    }
+
+   return lo;
 }
 
-void gpio_apply_clicked(GtkButton * button, gpointer user_data)
-{
-   int i;
-   uint32_t notifyBits = 0;
+/*
+Return the first sample after n, up to last, at which a gpio in mask
+changed level, or -1.  Segments in which none of the gpios changed are
+passed over using the top of their pyramid.
+*/
 
-   gtk_widget_hide(gGpioDialog);
+static int64_t store_nextEdge
+   (piscopeStore_t *st, int64_t n, int64_t last, uint32_t mask)
+{
+   piscopeSegment_t *seg;
+   int64_t segno, found;
+   int offset, best, g, i;
+   uint32_t gpios;
 
-   /* get and set states */
+   n++;
 
-   g_free(gSettings.activeGPIOs);
-   gSettings.activeGPIOCount = gDisplayedGpios = 0;
-   gSettings.activeGPIOs = g_malloc(PISCOPE_GPIOS * sizeof(gint));
+   offset = n & (PISCOPE_SEG_SAMPLES-1);
 
-   for (i=0; i<PISCOPE_GPIOS; i++)
+   for (segno = n >> PISCOPE_SEG_SHIFT;
+        segno <= (last >> PISCOPE_SEG_SHIFT);
+        segno++, offset = 0)
    {
-      gGpioInfo[i].display =
-         gtk_toggle_button_get_active(gGpioInfo[i].button);
+      seg = store_seg(st, segno << PISCOPE_SEG_SHIFT);
 
-      if (gGpioInfo[i].display)
+      gpios = seg->pyr[gPyrOffset[PISCOPE_PYR_LEVELS]] & mask;
+
+      best = PISCOPE_SEG_SAMPLES;
+
+      while (gpios)
       {
-         gSettings.activeGPIOs[gSettings.activeGPIOCount++] = i;
-         gDisplayedGpios++;
+         g = __builtin_ctz(gpios);
 
-         notifyBits |= (1<<i);
+         gpios &= (gpios - 1);
+
+         i = store_edgeBsearch(seg->edge[g], seg->edges[g], offset);
+
+         if ((i < seg->edges[g]) && (seg->edge[g][i] < best))
+            best = seg->edge[g][i];
+      }
+
+      if (best < PISCOPE_SEG_SAMPLES)
+      {
+         found = (segno << PISCOPE_SEG_SHIFT) + best;
+
+         if (found <= last) return found; else return -1;
       }
    }
 
-   if (gDisplayedGpios == 0)
+   return -1;
+}
+
+/*
+Return the last sample at or before n at which a gpio in mask changed
+level, or -1.
+*/
+
+static int64_t store_prevEdge(piscopeStore_t *st, int64_t n, uint32_t mask)
+{
+   piscopeSegment_t *seg;
+   int64_t segno, found;
+   int offset, best, g, i;
+   uint32_t gpios;
+
+   offset = n & (PISCOPE_SEG_SAMPLES-1);
+
+   for (segno = n >> PISCOPE_SEG_SHIFT;
+        segno >= st->firstSeg;
+        segno--, offset = PISCOPE_SEG_SAMPLES-1)
    {
-      /* not worth the hassle of allowing zero gpios,
-         arbitrarily display gpio#0 */
+      seg = store_seg(st, segno << PISCOPE_SEG_SHIFT);
 
-      gDisplayedGpios      = 1;
-      gGpioInfo[0].display = 1;
-      gSettings.activeGPIOs[0] = 0;
-      gSettings.activeGPIOCount = 1;
-   }
+      gpios = seg->pyr[gPyrOffset[PISCOPE_PYR_LEVELS]] & mask;
 
-   pigpioCommand(gPigSocket, PI_CMD_NB, gPigHandle, notifyBits);
+      best = -1;
 
-   util_calcGpioY();
+      while (gpios)
+      {
+         g = __builtin_ctz(gpios);
 
-   pigpioSaveSettings();
-}
+         gpios &= (gpios - 1);
 
-void gpio_cancel_clicked(GtkButton * button, gpointer user_data)
-{
-   int i;
+         i = store_edgeBsearch(seg->edge[g], seg->edges[g], offset+1) - 1;
 
-   gtk_widget_hide(gGpioDialog);
+         if ((i >= 0) && (seg->edge[g][i] > best)) best = seg->edge[g][i];
+      }
 
-   /* set the gpio states to those saved earlier */
+      if (best >= 0)
+      {
+         found = (segno << PISCOPE_SEG_SHIFT) + best;
 
-   for (i=0; i<PISCOPE_GPIOS; i++)
-   {
-      gtk_toggle_button_set_active(gGpioInfo[i].button, gGpioTempDisplay[i]);
+         if (found > st->first) return found; else return -1;
+      }
    }
+
+   return -1;
 }
 
-/* TRGS ------------------------------------------------------------------- */
+/* the first trigger hit after n, up to last, or -1 */
 
-static void trgs_reset(void)
+static int64_t store_nextHit(piscopeStore_t *st, int64_t n, int64_t last)
 {
-   int i;
+   piscopeSegment_t *seg;
+   int64_t segno, found;
+   int offset, i;
 
-   gTriggerFired = 0;
-   gTriggerCount = 0;
+   n++;
 
-   for (i=0; i<PISCOPE_TRIGGERS; i++) gTrigInfo[i].fired = 0;
+   offset = n & (PISCOPE_SEG_SAMPLES-1);
+
+   for (segno = n >> PISCOPE_SEG_SHIFT;
+        segno <= (last >> PISCOPE_SEG_SHIFT);
+        segno++, offset = 0)
+   {
+      seg = store_seg(st, segno << PISCOPE_SEG_SHIFT);
+
+      i = store_edgeBsearch(seg->hit, seg->hits, offset);
+
+      if (i < seg->hits)
+      {
+         found = (segno << PISCOPE_SEG_SHIFT) + seg->hit[i];
+
+         if (found <= last) return found; else return -1;
+      }
+   }
+
+   return -1;
 }
 
-static void trgs_lab_str(int trig)
+/* the last trigger hit at or before n, or -1 */
+
+static int64_t store_prevHit(piscopeStore_t *st, int64_t n)
 {
-   int i;
-   char *trigTypeStr= "-01EFR";
-   char buf[PISCOPE_GPIOS+1];
+   piscopeSegment_t *seg;
+   int64_t segno, found;
+   int offset, i;
 
-   for (i=0; i<PISCOPE_GPIOS; i++)
+   offset = n & (PISCOPE_SEG_SAMPLES-1);
+
+   for (segno = n >> PISCOPE_SEG_SHIFT;
+        segno >= st->firstSeg;
+        segno--, offset = PISCOPE_SEG_SAMPLES-1)
    {
-      buf[i] = trigTypeStr[gTrigInfo[trig].type[i]];
-   }
+      seg = store_seg(st, segno << PISCOPE_SEG_SHIFT);
 
-   buf[PISCOPE_GPIOS] = 0;
+      i = store_edgeBsearch(seg->hit, seg->hits, offset+1) - 1;
 
-   util_labelText(gTrigInfo[trig].labelW, buf);
-}
+      if (i >= 0)
+      {
+         found = (segno << PISCOPE_SEG_SHIFT) + seg->hit[i];
 
-static void trgs_when_changed(GtkComboBox *widget, int trig)
-{
-   gTrigInfo[trig-1].when = gtk_combo_box_get_active(widget);
-}
+         if (found > st->first) return found; else return -1;
+      }
+   }
 
-void trgs_when1_changed(GtkComboBox *widget, gpointer user_data)
-{
-   trgs_when_changed(widget, 1);
+   return -1;
 }
 
-void trgs_when2_changed(GtkComboBox *widget, gpointer user_data)
-{
-   trgs_when_changed(widget, 2);
-}
+/* the first sample after n, up to last, preceded by lost reports, or -1 */
 
-void trgs_when3_changed(GtkComboBox *widget, gpointer user_data)
+static int64_t store_nextGap(piscopeStore_t *st, int64_t n, int64_t last)
 {
-   trgs_when_changed(widget, 3);
-}
+   piscopeSegment_t *seg;
+   int64_t segno, found;
+   int offset, i;
 
-void trgs_when4_changed(GtkComboBox *widget, gpointer user_data)
-{
-   trgs_when_changed(widget, 4);
+   n++;
+
+   offset = n & (PISCOPE_SEG_SAMPLES-1);
+
+   for (segno = n >> PISCOPE_SEG_SHIFT;
+        segno <= (last >> PISCOPE_SEG_SHIFT);
+        segno++, offset = 0)
+   {
+      seg = store_seg(st, segno << PISCOPE_SEG_SHIFT);
+
+      i = store_edgeBsearch(seg->gap, seg->gaps, offset);
+
+      if (i < seg->gaps)
+      {
+         found = (segno << PISCOPE_SEG_SHIFT) + seg->gap[i];
+
+         if (found <= last) return found; else return -1;
+      }
+   }
+
+   return -1;
 }
 
-void trgs_samples_changed(GtkComboBox *widget, gpointer user_data)
+static void store_dropOldest(piscopeStore_t *st)
 {
-   int i;
+   store_detach(st, st->headSeg);
 
-   i = gtk_combo_box_get_active(widget);
+   if (++st->headSeg >= st->maxSegs) st->headSeg = 0;
 
-   sscanf(gTrigSamplesText[i], "%d", &gTrigSamples);
+   st->firstSeg++;
+   st->numSegs--;
+
+   if (st->first < (st->firstSeg << PISCOPE_SEG_SHIFT))
+      st->first = st->firstSeg << PISCOPE_SEG_SHIFT;
 }
 
-static void trgs_on_toggled(GtkToggleButton *button, int trig)
+/* start segment n>>SEG_SHIFT, returns 0 if there is no room */
+
+static int store_newSegment(piscopeStore_t *st, int64_t n, int dropOldest)
 {
-   int on;
+   piscopeSegment_t *seg;
+   int slot;
 
-   on = gtk_toggle_button_get_active(button);
+   while ((st->numSegs == st->maxSegs) ||
+          (!st->map && st->numSegs &&
+           ((st->bytes + (int64_t)sizeof(piscopeRaw_t)) > st->budget)))
+   {
+      if (!dropOldest || (st->numSegs < 2)) return 0;
+
+      store_dropOldest(st);
+   }
 
-   if (gTrigInfo[trig-1].levelMask | gTrigInfo[trig-1].changedMask)
+   slot = st->headSeg + st->numSegs;
+   if (slot >= st->maxSegs) slot -= st->maxSegs;
+
+   if (!st->seg[slot])
    {
-      if (on)
-      {
-         gTrigInfo[trig-1].enabled = 1;
-      }
-      else
-      {
-         gTrigInfo[trig-1].enabled = 0;
-      }
+      st->seg[slot] = g_try_malloc0(sizeof(piscopeSegment_t));
+
+      if (!st->seg[slot]) return 0;
+
+      st->seg[slot]->refs = 1;
+   }
+
+   seg = st->seg[slot];
+
+   if (st->map)
+   {
+      seg->raw = (piscopeRaw_t *)st->map + slot;
    }
    else
    {
-      if (on)
+      if (st->spare)
       {
-         /* illegal trigger, force off */
-         gtk_toggle_button_set_active(button, 0);
+         seg->raw  = st->spare;
+         st->spare = NULL;
       }
+      else seg->raw = g_try_malloc(sizeof(piscopeRaw_t));
+
+      if (!seg->raw) return 0;
+
+      st->bytes += sizeof(piscopeRaw_t);
    }
-}
 
-void trgs_on1_toggled(GtkToggleButton * button, gpointer user_data)
-{
-   trgs_on_toggled(button, 1);
-}
+   seg->pyr = seg->raw->pyr;
 
-void trgs_on2_toggled(GtkToggleButton * button, gpointer user_data)
-{
-   trgs_on_toggled(button, 2);
-}
+   st->numSegs++;
 
-void trgs_on3_toggled(GtkToggleButton * button, gpointer user_data)
-{
-   trgs_on_toggled(button, 3);
-}
+   /* pack the newest segment which has gone cold */
 
-void trgs_on4_toggled(GtkToggleButton * button, gpointer user_data)
-{
-   trgs_on_toggled(button, 4);
-}
+   if (!st->map && (st->numSegs > PISCOPE_HOT_SEGS))
+   {
+      seg = store_seg(st, n - (PISCOPE_HOT_SEGS << PISCOPE_SEG_SHIFT));
 
-void trgs_edit1_clicked(GtkButton * button, gpointer user_data)
-{
-   util_trig_activate(1);
+      if (seg->raw) store_pack(st, seg);
+   }
+
+   return 1;
 }
 
-void trgs_edit2_clicked(GtkButton * button, gpointer user_data)
+/*
+Append a sample.  When the store is full the oldest segment is dropped
+if dropOldest is set, otherwise the sample is refused and -1 returned.
+*/
+
+static int64_t store_append
+   (piscopeStore_t *st, int64_t tick, uint32_t level, int dropOldest)
 {
-   util_trig_activate(2);
+   piscopeSegment_t *seg;
+   int64_t n;
+   int offset;
+
+   n = st->next;
+
+   offset = n & (PISCOPE_SEG_SAMPLES-1);
+
+   if (!offset)
+   {
+      if (!store_newSegment(st, n, dropOldest)) return -1;
+   }
+
+   seg = store_seg(st, n);
+
+   seg->raw->tick[offset]  = tick;
+   seg->raw->level[offset] = level;
+
+   if (n > st->first)
+   {
+      store_pyrUpdate(seg, offset, level ^ st->lastLevel);
+      store_edgeUpdate(st, seg, offset, level ^ st->lastLevel);
+   }
+   else store_pyrUpdate(seg, offset, 0);
+
+   st->lastLevel = level;
+
+   st->next = n + 1;
+
+   return n;
 }
 
-void trgs_edit3_clicked(GtkButton * button, gpointer user_data)
+/* make snap a snapshot of the samples now in st */
+
+static void store_snapshot(piscopeStore_t *snap, piscopeStore_t *st)
 {
-   util_trig_activate(3);
+   int i, slot;
+
+   store_free(snap);
+
+   snap->maxSegs = st->numSegs;
+
+   snap->seg = g_malloc0((snap->maxSegs + 1) * sizeof(piscopeSegment_t *));
+
+   for (i=0; i<st->numSegs; i++)
+   {
+      slot = st->headSeg + i;
+      if (slot >= st->maxSegs) slot -= st->maxSegs;
+
+      snap->seg[i] = st->seg[slot];
+      snap->seg[i]->refs++;
+   }
+
+   snap->numSegs   = st->numSegs;
+   snap->headSeg   = 0;
+   snap->firstSeg  = st->firstSeg;
+   snap->first     = st->first;
+   snap->next      = st->next;
+   snap->lastLevel = st->lastLevel;
+   snap->budget    = 0;
 }
 
-void trgs_edit4_clicked(GtkButton * button, gpointer user_data)
+/*
+Display a snapshot of the store, so it is not disturbed by the samples
+which keep arriving, or the store itself.
+*/
+
+static void store_setView(int frozen)
 {
-   util_trig_activate(4);
+   store_free(&gSnap);
+
+   gWaveValid = 0;
+   gTileGen++;
+
+   if (frozen)
+   {
+      store_snapshot(&gSnap, &gStore);
+
+      gView = &gSnap;
+   }
+   else gView = &gStore;
 }
 
-void trgs_close_clicked(GtkButton * button, gpointer user_data)
+/* PYRAMID ---------------------------------------------------------------- */
+
+/*
+Walk the samples after s up to and including e once, filling in
+colEdges with the gpios which changed in pixel columns x0 to columns-1
+and colLevel with the levels at the end of each column.  s is the last
+sample before column x0.  Whole buckets which finish inside the current
+column are skipped using the coarsest complete pyramid level, so the
+cost depends on the width of the view rather than the number of samples
+in it.  With minLevel above 0 a bucket up to that level which straddles
+a column is still taken whole if it ends before the column after, so
+its edges are drawn at most a pixel early.
+*/
+
+static uint32_t pyr_scanColumns
+(
+   piscopeStore_t *st,
+   int64_t         s,
+   int64_t         e,
+   int64_t         startTick,
+   uint32_t        deciMicroPerPix,
+   int             x0,
+   int             columns,
+   int             minLevel,
+   uint32_t       *colEdges,
+   uint32_t       *colLevel
+)
 {
-   int i, j;
-   gtk_widget_hide(gTrgsDialog);
+   piscopeSegment_t *seg;
+   int x, k, n, size, offset;
+   int64_t next, remaining, bound, limit, nextBound;
+   uint32_t edges, level, first, frac, step, stepFrac;
 
-   for(i=0; i< sizeof(gTrigSamplesText)/sizeof(gTrigSamplesText[0]); i++)
+   first = store_level(st, s);
+   level = first;
+
+   remaining = e - s;
+
+   next = s + 1;
+
+   /*
+   The column bounds are stepped in whole ticks plus tenths rather
+   than divided out for every column.  bound is the first tick of
+   column x+1 and frac the tenths past it, counted up by 9 so that
+   the bound rounds up as the divide did.
+   */
+
+   bound = startTick + (((int64_t)x0 * deciMicroPerPix) + 9) / 10;
+   frac  = (((int64_t)x0 * deciMicroPerPix) + 9) % 10;
+
+   step     = deciMicroPerPix / 10;
+   stepFrac = deciMicroPerPix % 10;
+
+   for (x=x0; x<columns; x++)
+   {
+      edges = 0;
+
+      /* first tick belonging to the next column */
+
+      bound += step;
+      frac  += stepFrac;
+
+      if (frac >= 10)
       {
-         sscanf(gTrigSamplesText[i], "%d", &j);
-         if(j == gTrigSamples)
-            {
-               gSettings.triggerSamples = i;
-               break;
-            }
+         bound++;
+         frac -= 10;
       }
 
-   for(i=0; i<PISCOPE_TRIGGERS; i++)
+      /* and that of the column after */
+
+      nextBound = bound + step + ((frac + stepFrac) >= 10);
+
+      while (remaining)
       {
-         gSettings.triggers[i].enabled = gTrigInfo[i].enabled;
-         gSettings.triggers[i].action = gTrigInfo[i].when;
-         for (j=0; j<PISCOPE_GPIOS; j++)
-            gSettings.triggers[i].gpiotypes[j] = gTrigInfo[i].type[j];
+         seg = store_seg(st, next);
+
+         offset = next & (PISCOPE_SEG_SAMPLES-1);
+
+         if (store_segTick(seg, offset) >= bound) break;
+
+         n = 0;
+
+         for (k=1; k<=PISCOPE_PYR_LEVELS; k++)
+         {
+            size = 1 << (PISCOPE_PYR_SHIFT * k);
+
+            if ((offset & (size-1)) || (size > remaining)) break;
+
+            /* buckets up to minLevel may end in the column after, their
+               edges there are drawn a pixel early */
+
+            if (k > minLevel) limit = bound; else limit = nextBound;
+
+            if (store_segLastTick(seg, offset, size) >= limit) break;
+
+            n = k;
+         }
+
+         if (n)
+         {
+            size = 1 << (PISCOPE_PYR_SHIFT * n);
+
+            edges |= seg->pyr[gPyrOffset[n] +
+                              (offset >> (PISCOPE_PYR_SHIFT * n))];
+         }
+         else
+         {
+            size = 1;
+
+            edges |= store_segLevel(seg, offset) ^ level;
+         }
+
+         level = store_segLastLevel(seg, offset, size);
+
+         next      += size;
+         remaining -= size;
       }
-   pigpioSaveSettings();
+
+      colEdges[x] = edges;
+      colLevel[x] = level;
+   }
+
+   return first;
 }
 
-/* TRIG ------------------------------------------------------------------- */
+/* RASTER ----------------------------------------------------------------- */
 
-void trig_apply_clicked(GtkButton * button, gpointer user_data)
-{
-   int i;
+/*
+The lanes are only ever horizontal and vertical runs between whole
+pixels, so they are filled straight into the RGB24 wave surface rather
+than stroked.  A run covers the pixels a 2.0 wide stroke along it does,
+and a riser meeting a level adds the square of the mitred corner.  The
+0.5 wide tick line covers a quarter of a row each side, which Cairo
+samples as 4 of 15 sub-rows.  PISCOPE_RENDER in the environment may
+name cairo to stroke the lanes as before, or span to keep the rasterizer
+on the UI thread rather than spread wide strips over the render pool.
+*/
 
-   if (!gTriggerNum) return;
+static int gRasterCairo;
+static int gRenderThreads;
 
-   for (i=0; i<PISCOPE_GPIOS; i++)
-      {
-         gSettings.triggers[gTriggerNum-1].gpiotypes[i] = gtk_combo_box_get_active(GTK_COMBO_BOX(gTrigCombo[i]));
-      }
-   util_setTriggerGPIOTypes(gTriggerNum-1);
+static void raster_init(void)
+{
+   const char *want;
 
-   trgs_lab_str(gTriggerNum-1);
+   want = getenv("PISCOPE_RENDER");
 
-   gtk_widget_hide(gTrigDialog);
+   gRasterCairo = ((want != NULL) && (strcmp(want, "cairo") == 0));
 
-   gTriggerNum = 0;
+   if ((want != NULL) && (strcmp(want, "span") == 0)) gRenderThreads = 1;
+   else gRenderThreads = g_get_num_processors();
 }
 
-void trig_cancel_clicked(GtkButton * button, gpointer user_data)
+static void raster_fill
+   (piscopeRaster_t *r, int x0, int x1, int y0, int y1, uint32_t rgb)
 {
-   gtk_widget_hide(gTrigDialog);
+   int x, y;
+   uint32_t *row;
 
-   gTriggerNum = 0;
+   if (x0 < r->x0)       x0 = r->x0;
+   if (x1 > r->x1)       x1 = r->x1;
+   if (y0 < 0)           y0 = 0;
+   if (y1 > gCoscHeight) y1 = gCoscHeight;
+
+   for (y=y0; y<y1; y++)
+   {
+      row = r->pix + (y * r->stride);
+
+      for (x=x0; x<x1; x++) row[x] = rgb;
+   }
 }
 
-void trig_countsShow(void)
+static void raster_tick(piscopeRaster_t *r, int yTick)
 {
-   static char symbol[]="#>~<";
-
-   int i;
-   char c[PISCOPE_TRIGGERS];
-   char buf[128];
+   int x, y, c, shift;
+   uint32_t *row, pix, out;
 
-   for (i=0; i<PISCOPE_TRIGGERS; i++)
+   for (y=yTick-1; y<=yTick; y++)
    {
-      if (gTrigInfo[i].enabled) c[i] = symbol[gTrigInfo[i].when];
-      else                      c[i] = ' ';
+      if ((y < 0) || (y >= gCoscHeight)) continue;
+
+      row = r->pix + (y * r->stride);
+
+      for (x=r->x0; x<r->x1; x++)
+      {
+         pix = row[x];
+         out = 0;
+
+         /* white over each channel, rounded as pixman does */
+
+         for (shift=0; shift<24; shift+=8)
+         {
+            c = ((pix >> shift) & 255) * (255 - PISCOPE_TICK_COVER) + 128;
+            c = ((c + (c >> 8)) >> 8) + PISCOPE_TICK_COVER;
+
+            out |= (uint32_t)c << shift;
+         }
+
+         row[x] = out;
+      }
    }
+}
 
-   sprintf(buf, "1%c%Lu  2%c%Lu  3%c%Lu  4%c%Lu",
-      c[0], (long long)gTrigInfo[0].count,
-      c[1], (long long)gTrigInfo[1].count,
-      c[2], (long long)gTrigInfo[2].count,
-      c[3], (long long)gTrigInfo[3].count);
+static void raster_lane
+   (piscopeRaster_t *r, int g, uint32_t level, int c0, int c1)
+{
+   int x, xa, y, yNext;
+   uint32_t bit;
 
-   util_labelText(gMainLtrigs, buf);
+   bit = (1<<g);
+
+   if (level & bit) y = gGpioInfo[g].y_high;
+   else             y = gGpioInfo[g].y_low;
+
+   xa = c0;
+
+   for (x=c0; x<c1; x++)
+   {
+      if (r->edges[x] & bit)
+      {
+         /* the level so far and its corner, none at the path start */
+
+         if (x > xa) raster_fill(r, xa, x+1, y-1, y+1, PISCOPE_WAVE_RGB);
+
+         if (gGpioInfo[g].y_high < gGpioInfo[g].y_low)
+            raster_fill(r, x-1, x+1, gGpioInfo[g].y_high, gGpioInfo[g].y_low,
+               PISCOPE_WAVE_RGB);
+         else /* lanes squeezed below 4 pixels */
+            raster_fill(r, x-1, x+1, gGpioInfo[g].y_low, gGpioInfo[g].y_high,
+               PISCOPE_WAVE_RGB);
+
+         if (r->level[x] & bit) yNext = gGpioInfo[g].y_high;
+         else                   yNext = gGpioInfo[g].y_low;
+
+         /* the corner turning into the next level, a riser that comes
+            straight back down has no join at its far end */
+
+         raster_fill(r, x-1, x+1, yNext-1, yNext+1, PISCOPE_WAVE_RGB);
+
+         xa = x;
+         y  = yNext;
+      }
+   }
+
+   raster_fill(r, xa, c1, y-1, y+1, PISCOPE_WAVE_RGB);
+}
+
+/* fill the clip of r from columns c0 to c1, level is that before c0 */
+
+static void raster_lanes(piscopeRaster_t *r, uint32_t level, int c0, int c1)
+{
+   int g;
+
+   raster_fill(r, r->x0, r->x1, 0, gCoscHeight, 0);
+
+   for (g=0; g<PISCOPE_GPIOS; g++)
+   {
+      if (gGpioInfo[g].display)
+      {
+         raster_tick(r, gGpioInfo[g].y_tick);
+
+         raster_lane(r, g, level, c0, c1);
+      }
+   }
+}
+
+static void raster_surface(piscopeRaster_t *r)
+{
+   cairo_surface_flush(gWaveSurface);
+
+   r->pix    = (uint32_t *)cairo_image_surface_get_data(gWaveSurface);
+   r->stride = cairo_image_surface_get_stride(gWaveSurface) / 4;
+   r->x0     = 0;
+   r->x1     = gCoscWidth;
+   r->edges  = gColEdges;
+   r->level  = gColLevel;
+}
+
+/* ENGINE ----------------------------------------------------------------- */
+
+static void engine_set(int t, uint32_t levelMask, uint32_t levelValue,
+   uint32_t changedMask)
+{
+   int k, v, shift;
+   uint32_t lm, lv, cm;
+
+   for (k=0; k<4; k++)
+   {
+      shift = 8 * k;
+
+      lm = (levelMask   >> shift) & 255;
+      lv = (levelValue  >> shift) & 255;
+      cm = (changedMask >> shift) & 255;
+
+      for (v=0; v<256; v++)
+      {
+         if ((v & lm) == lv) gEngine.level[k][v]   |= (1ULL<<t);
+         if ((v & cm) == cm) gEngine.changed[k][v] |= (1ULL<<t);
+      }
+   }
+}
+
+/* rebuild the tables from the enabled triggers and the counters */
+
+static void engine_compile(void)
+{
+   int i, k, t;
+   uint32_t levelMask, levelValue, changedMask;
+   piscopeSequenceSettings_t *seq;
+   piscopeStage_t *stage;
+
+   memset(&gEngine, 0, sizeof(gEngine));
+
+   gIdleTriggers = 0;
+
+   for (i=0; i<PISCOPE_TRIGGERS; i++)
+   {
+      if (gTrigInfo[i].enabled)
+      {
+         engine_set(i, gTrigInfo[i].levelMask, gTrigInfo[i].levelValue,
+            gTrigInfo[i].changedMask);
+
+         if (gTrigInfo[i].idleMask && !gTrigInfo[i].changedMask &&
+             (gTrigInfo[i].durationMask == gTrigInfo[i].idleMask))
+            gIdleTriggers |= (1<<i);
+      }
+   }
+
+   for (i=0; i<gSettings.counters; i++)
+   {
+      util_compileGPIOTypes(gSettings.counter[i].gpiotypes,
+         &levelMask, &levelValue, &changedMask);
+
+      if (levelMask | changedMask)
+      {
+         engine_set
+            (PISCOPE_TRIGGERS+i, levelMask, levelValue, changedMask);
+      }
+   }
+
+   /* sequence stages take the entries after the counters */
+
+   t = PISCOPE_TRIGGERS + gSettings.counters;
+
+   for (i=0; i<gSettings.sequences; i++)
+   {
+      seq = &gSettings.sequence[i];
+
+      gSequence[i].stages  = seq->stages;
+      gSequence[i].when    = seq->action;
+      gSequence[i].at      = 0;
+      gSequence[i].repeats = 0;
+
+      for (k=0; k<seq->stages; k++)
+      {
+         stage = &gSequence[i].stage[k];
+
+         util_compileGPIOTypes(seq->stage[k].gpiotypes,
+            &levelMask, &levelValue, &changedMask);
+
+         stage->entry = 0;
+
+         if ((t < PISCOPE_MAX_TRIGGERS) && (levelMask | changedMask))
+         {
+            engine_set(t, levelMask, levelValue, changedMask);
+
+            stage->entry = 1ULL<<t;
+
+            t++;
+         }
+
+         util_compileGPIOTypes(seq->stage[k].holdtypes,
+            &stage->holdMask, &stage->holdValue, &changedMask);
+
+         stage->repeat = seq->stage[k].repeat;
+         stage->within = seq->stage[k].within;
+
+         if (stage->repeat < 1) stage->repeat = 1;
+      }
+   }
+}
+
+/* return the triggers and counters matched by a change from old to new */
+
+static inline uint64_t engine_match(uint32_t new, uint32_t old)
+{
+   uint32_t changed;
+
+   changed = new ^ old;
+
+   return
+      gEngine.level[0][new & 255]         &
+      gEngine.level[1][(new >> 8) & 255]  &
+      gEngine.level[2][(new >> 16) & 255] &
+      gEngine.level[3][new >> 24]         &
+      gEngine.changed[0][changed & 255]         &
+      gEngine.changed[1][(changed >> 8) & 255]  &
+      gEngine.changed[2][(changed >> 16) & 255] &
+      gEngine.changed[3][changed >> 24];
+}
+
+/*
+Remove from matched the triggers whose duration conditions fail at a
+sample at tick.  lastEdge[g] is the tick of the last edge of gpio g
+before the sample, or -1 if not known, and prevTick that of the sample
+stored before.  An idle condition holds only at the first sample past
+T, so a trigger which mixes one with other conditions is matched on the
+stored samples alone, however the reports between them arrived.
+*/
+
+static uint64_t engine_durations
+   (uint64_t matched, int64_t tick, int64_t prevTick, const int64_t *lastEdge)
+{
+   piscopeTrigInfo_t *trig;
+   uint32_t gpios;
+   int64_t width;
+   int i, g, ok;
+
+   for (i=0; i<PISCOPE_TRIGGERS; i++)
+   {
+      trig = &gTrigInfo[i];
+
+      if (!(matched & (1<<i)) || !trig->durationMask) continue;
+
+      gpios = trig->durationMask;
+
+      ok = 1;
+
+      while (ok && gpios)
+      {
+         g = __builtin_ctz(gpios);
+
+         gpios &= (gpios - 1);
+
+         if (lastEdge[g] < 0) {ok = 0; break;}
+
+         width = tick - lastEdge[g];
+
+         switch (trig->type[g])
+         {
+            case piscope_high_gt:
+            case piscope_low_gt:
+               ok = (width > trig->micros);
+               break;
+
+            case piscope_high_lt:
+            case piscope_low_lt:
+            case piscope_runt_lt:
+               ok = (width < trig->micros);
+               break;
+
+            case piscope_idle_gt:
+               ok = (width > trig->micros) &&
+                    ((prevTick - lastEdge[g]) <= trig->micros);
+               break;
+
+            default:
+               break;
+         }
+      }
+
+      if (!ok) matched &= ~(1ULL<<i);
+   }
+
+   return matched;
+}
+
+/*
+The triggers whose only edge conditions are Idle>T are matched here
+rather than by engine_match, as a quiet gpio stores no samples.  One
+matches once the newest edge of its idle gpios is more than T before
+tick but was not at prevTick, while level, that held since prevTick,
+meets its level conditions.  So it matches once whether a sample or a
+report first passes T, and however the reports were batched.
+*/
+
+static uint32_t engine_idle
+   (uint32_t level, int64_t tick, int64_t prevTick, const int64_t *lastEdge)
+{
+   piscopeTrigInfo_t *trig;
+   uint32_t gpios, matched;
+   int64_t newest;
+   int i, g;
+
+   matched = 0;
+
+   for (i=0; i<PISCOPE_TRIGGERS; i++)
+   {
+      trig = &gTrigInfo[i];
+
+      if (!(gIdleTriggers & (1<<i))) continue;
+
+      if ((level & trig->levelMask) != trig->levelValue) continue;
+
+      newest = -1;
+
+      for (gpios=trig->idleMask; gpios; gpios &= (gpios - 1))
+      {
+         g = __builtin_ctz(gpios);
+
+         if (lastEdge[g] < 0) {newest = -1; break;}
+
+         if (lastEdge[g] > newest) newest = lastEdge[g];
+      }
+
+      if ((newest >= 0) && ((tick - newest) > trig->micros) &&
+          ((prevTick - newest) <= trig->micros)) matched |= (1<<i);
+   }
+
+   return matched;
+}
+
+/*
+Match a batch of consecutive levels, the first following old.  Levels
+which repeat the one before are never stored so are not matched.
+*/
+
+static void engine_matchBatch
+   (const uint32_t *level, uint32_t old, int count, uint64_t *matched)
+{
+   int i;
+
+   for (i=0; i<count; i++)
+   {
+      if (level[i] != old) matched[i] = engine_match(level[i], old);
+      else                 matched[i] = 0;
+
+      old = level[i];
+   }
+}
+
+/* INGEST ----------------------------------------------------------------- */
+
+/*
+A run of reports is reduced to the samples where the level changed, with
+their ticks extended to 64 bits.  The kernel is chosen at start up from
+what the CPU supports, PISCOPE_KERNEL in the environment may name one.
+The NEON kernel has yet to pass make bench on a Pi, so it is only used
+when PISCOPE_KERNEL=neon names it.  Every kernel must give the same
+output as ingest_scalar, which also takes any leftover reports and any
+group holding a tick wrap.
+*/
+
+static piscopeKernel_t gKernel;
+static const char      *gKernelName;
+
+static int ingest_scalar
+   (const gpioReport_t *report, int count, piscopeIngest_t *in,
+    int64_t *tick, uint32_t *level)
+{
+   int i, n;
+
+   n = 0;
+
+   for (i=0; i<count; i++)
+   {
+      if ((in->lastTick > 0xF0000000) && (report[i].tick < 0x10000000))
+      {
+         in->high += (1LL<<32);
+      }
+
+      in->lastTick = report[i].tick;
+
+      if (report[i].level != in->lastLevel)
+      {
+         tick[n]  = in->high | report[i].tick;
+         level[n] = report[i].level;
+
+         in->lastLevel = report[i].level;
+
+         n++;
+      }
+   }
+
+   return n;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static uint32_t gCompact8[256][8]; /* lanes of each changed mask */
+
+/* split 4 reports into their ticks and levels */
+
+__attribute__((target("sse2")))
+static inline void ingest_split4
+   (const gpioReport_t *report, __m128i *tick, __m128i *level)
+{
+   __m128 v0, v1, v2, a, b;
+
+   v0 = _mm_loadu_ps((const float *)report);
+   v1 = _mm_loadu_ps((const float *)report + 4);
+   v2 = _mm_loadu_ps((const float *)report + 8);
+
+   a = _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(1,0,2,1)); /* t0 l0 t1 l1 */
+   b = _mm_shuffle_ps(v1, v2, _MM_SHUFFLE(2,2,3,3)); /* t2 t2 t3 t3 */
+
+   *tick  = _mm_castps_si128(_mm_shuffle_ps(a, b,  _MM_SHUFFLE(2,0,2,0)));
+   *level = _mm_castps_si128(_mm_shuffle_ps(a, v2, _MM_SHUFFLE(3,0,3,1)));
+}
+
+__attribute__((target("sse2")))
+static int ingest_sse2
+   (const gpioReport_t *report, int count, piscopeIngest_t *in,
+    int64_t *tick, uint32_t *level)
+{
+   __m128i t, l, prev, bias, wrapHi, wrapLo, high, zero;
+   uint32_t lt[4], ll[4];
+   int i, j, n, changed;
+
+   bias   = _mm_set1_epi32(0x80000000);
+   wrapHi = _mm_set1_epi32(0xF0000000 ^ 0x80000000);
+   wrapLo = _mm_set1_epi32(0x10000000 ^ 0x80000000);
+   zero   = _mm_setzero_si128();
+
+   n = 0;
+
+   for (i=0; (i+4)<=count; i+=4)
+   {
+      ingest_split4(report+i, &t, &l);
+
+      /* unsigned tick compares, done signed on biased values */
+
+      prev = _mm_or_si128(_mm_slli_si128(t, 4),
+                          _mm_cvtsi32_si128((int)in->lastTick));
+
+      if (_mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(
+             _mm_cmpgt_epi32(_mm_xor_si128(prev, bias), wrapHi),
+             _mm_cmplt_epi32(_mm_xor_si128(t, bias), wrapLo)))))
+      {
+         n += ingest_scalar(report+i, 4, in, tick+n, level+n);
+         continue;
+      }
+
+      prev = _mm_or_si128(_mm_slli_si128(l, 4),
+                          _mm_cvtsi32_si128((int)in->lastLevel));
+
+      changed = _mm_movemask_ps
+         (_mm_castsi128_ps(_mm_cmpeq_epi32(l, prev))) ^ 15;
+
+      high = _mm_set1_epi64x(in->high);
+
+      if (changed == 15)
+      {
+         _mm_storeu_si128((__m128i *)(level+n), l);
+
+         _mm_storeu_si128((__m128i *)(tick+n),
+            _mm_or_si128(_mm_unpacklo_epi32(t, zero), high));
+
+         _mm_storeu_si128((__m128i *)(tick+n+2),
+            _mm_or_si128(_mm_unpackhi_epi32(t, zero), high));
+
+         n += 4;
+      }
+      else if (changed)
+      {
+         _mm_storeu_si128((__m128i *)lt, t);
+         _mm_storeu_si128((__m128i *)ll, l);
+
+         for (; changed; changed &= (changed-1))
+         {
+            j = __builtin_ctz(changed);
+
+            tick[n]  = in->high | lt[j];
+            level[n] = ll[j];
+
+            n++;
+         }
+      }
+
+      in->lastTick  = report[i+3].tick;
+      in->lastLevel = report[i+3].level;
+   }
+
+   return n + ingest_scalar(report+i, count-i, in, tick+n, level+n);
+}
+
+__attribute__((target("avx2")))
+static int ingest_avx2
+   (const gpioReport_t *report, int count, piscopeIngest_t *in,
+    int64_t *tick, uint32_t *level)
+{
+   __m128i t0, l0, t1, l1;
+   __m256i t, l, prev, bias, wrapHi, wrapLo, high, lane, perm;
+   int i, n, changed;
+
+   bias   = _mm256_set1_epi32(0x80000000);
+   wrapHi = _mm256_set1_epi32(0xF0000000 ^ 0x80000000);
+   wrapLo = _mm256_set1_epi32(0x10000000 ^ 0x80000000);
+   lane   = _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6);
+
+   n = 0;
+
+   for (i=0; (i+8)<=count; i+=8)
+   {
+      ingest_split4(report+i,   &t0, &l0);
+      ingest_split4(report+i+4, &t1, &l1);
+
+      t = _mm256_inserti128_si256(_mm256_castsi128_si256(t0), t1, 1);
+      l = _mm256_inserti128_si256(_mm256_castsi128_si256(l0), l1, 1);
+
+      prev = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(t, lane),
+                                _mm256_set1_epi32((int)in->lastTick), 1);
+
+      if (_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(
+             _mm256_cmpgt_epi32(_mm256_xor_si256(prev, bias), wrapHi),
+             _mm256_cmpgt_epi32(wrapLo, _mm256_xor_si256(t, bias))))))
+      {
+         n += ingest_scalar(report+i, 8, in, tick+n, level+n);
+         continue;
+      }
+
+      prev = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(l, lane),
+                                _mm256_set1_epi32((int)in->lastLevel), 1);
+
+      changed = _mm256_movemask_ps
+         (_mm256_castsi256_ps(_mm256_cmpeq_epi32(l, prev))) ^ 255;
+
+      if (changed)
+      {
+         /* move the changed lanes down, whatever follows is overwritten */
+
+         perm = _mm256_loadu_si256((const __m256i *)gCompact8[changed]);
+
+         t = _mm256_permutevar8x32_epi32(t, perm);
+         l = _mm256_permutevar8x32_epi32(l, perm);
+
+         high = _mm256_set1_epi64x(in->high);
+
+         _mm256_storeu_si256((__m256i *)(level+n), l);
+
+         _mm256_storeu_si256((__m256i *)(tick+n), _mm256_or_si256(
+            _mm256_cvtepu32_epi64(_mm256_castsi256_si128(t)), high));
+
+         _mm256_storeu_si256((__m256i *)(tick+n+4), _mm256_or_si256(
+            _mm256_cvtepu32_epi64(_mm256_extracti128_si256(t, 1)), high));
+
+         n += __builtin_popcount(changed);
+      }
+
+      in->lastTick  = report[i+7].tick;
+      in->lastLevel = report[i+7].level;
+   }
+
+   return n + ingest_scalar(report+i, count-i, in, tick+n, level+n);
+}
+
+#endif
+
+#ifdef PISCOPE_NEON
+
+/* bit i set if lane i is set */
+
+PISCOPE_NEON_TARGET
+static inline int ingest_neonMask(uint32x4_t m)
+{
+   static const uint32_t bits[4] = {1, 2, 4, 8};
+
+   uint32x4_t v;
+   uint32x2_t s;
+
+   v = vandq_u32(m, vld1q_u32(bits));
+   s = vpadd_u32(vget_low_u32(v), vget_high_u32(v));
+   s = vpadd_u32(s, s);
+
+   return vget_lane_u32(s, 0);
+}
+
+PISCOPE_NEON_TARGET
+static int ingest_neon
+   (const gpioReport_t *report, int count, piscopeIngest_t *in,
+    int64_t *tick, uint32_t *level)
+{
+   uint32x4x3_t r;
+   uint32x4_t t, l, prev, wrapHi, wrapLo;
+   uint64x2_t high;
+   uint32_t lt[4], ll[4];
+   int i, j, n, changed;
+
+   wrapHi = vdupq_n_u32(0xF0000000);
+   wrapLo = vdupq_n_u32(0x10000000);
+
+   n = 0;
+
+   for (i=0; (i+4)<=count; i+=4)
+   {
+      /* seqno and flags, ticks, levels */
+
+      r = vld3q_u32((const uint32_t *)(report+i));
+
+      t = r.val[1];
+      l = r.val[2];
+
+      prev = vextq_u32(vdupq_n_u32(in->lastTick), t, 3);
+
+      if (ingest_neonMask(vandq_u32(vcgtq_u32(prev, wrapHi),
+                                    vcltq_u32(t, wrapLo))))
+      {
+         n += ingest_scalar(report+i, 4, in, tick+n, level+n);
+         continue;
+      }
+
+      prev = vextq_u32(vdupq_n_u32(in->lastLevel), l, 3);
+
+      changed = ingest_neonMask(vmvnq_u32(vceqq_u32(l, prev)));
+
+      if (changed == 15)
+      {
+         high = vdupq_n_u64((uint64_t)in->high);
+
+         vst1q_u32(level+n, l);
+
+         vst1q_u64((uint64_t *)(tick+n),
+            vorrq_u64(vmovl_u32(vget_low_u32(t)), high));
+
+         vst1q_u64((uint64_t *)(tick+n+2),
+            vorrq_u64(vmovl_u32(vget_high_u32(t)), high));
+
+         n += 4;
+      }
+      else if (changed)
+      {
+         vst1q_u32(lt, t);
+         vst1q_u32(ll, l);
+
+         for (; changed; changed &= (changed-1))
+         {
+            j = __builtin_ctz(changed);
+
+            tick[n]  = in->high | lt[j];
+            level[n] = ll[j];
+
+            n++;
+         }
+      }
+
+      in->lastTick  = report[i+3].tick;
+      in->lastLevel = report[i+3].level;
+   }
+
+   return n + ingest_scalar(report+i, count-i, in, tick+n, level+n);
+}
+
+#endif
+
+/*
+Account for reports pigpiod could not send and for flagged reports.
+Returns how many reports may be taken before the next gap, a gap found
+at the first report is recorded and taken.
+*/
+
+static int ingest_gap
+   (const gpioReport_t *report, int count, piscopeIngest_t *in)
+{
+   uint16_t odd, lost;
+   int i;
+
+   odd = 0;
+
+   for (i=0; i<count; i++)
+      odd |= (uint16_t)(report[i].seqno - in->seq - i) | report[i].flags;
+
+   if (!odd)
+   {
+      in->seq += count;
+      return count;
+   }
+
+   for (i=0; i<count; i++)
+   {
+      lost = report[i].seqno - in->seq;
+
+      if (lost)
+      {
+         if (i) return i;
+
+         in->lost += lost;
+         in->gaps++;
+         in->gap = 1;
+      }
+
+      if (report[i].flags & PI_NTFY_FLAGS_WDOG)  in->watchdogs++;
+      if (report[i].flags & PI_NTFY_FLAGS_ALIVE) in->alives++;
+
+      in->seq = report[i].seqno + 1;
+   }
+
+   return count;
+}
+
+static int ingest_want(const char *want, const char *name)
+{
+   return ((want == NULL) || (strcmp(want, name) == 0));
+}
+
+static void ingest_init(void)
+{
+   const char *want;
+#if defined(__x86_64__) || defined(__i386__)
+   int m, j, k;
+#endif
+
+   want = getenv("PISCOPE_KERNEL");
+
+   gKernel = ingest_scalar;
+   gKernelName = "scalar";
+
+#if defined(__x86_64__) || defined(__i386__)
+   __builtin_cpu_init();
+
+   if (__builtin_cpu_supports("sse2") && ingest_want(want, "sse2"))
+   {
+      gKernel = ingest_sse2;
+      gKernelName = "sse2";
+   }
+
+   if (__builtin_cpu_supports("avx2") && ingest_want(want, "avx2"))
+   {
+      for (m=0; m<256; m++)
+      {
+         for (j=0, k=0; j<8; j++) if (m & (1<<j)) gCompact8[m][k++] = j;
+      }
+
+      gKernel = ingest_avx2;
+      gKernelName = "avx2";
+   }
+#endif
+
+#ifdef PISCOPE_NEON
+#if defined(__arm__) && defined(HWCAP_ARM_NEON)
+   if ((getauxval(AT_HWCAP) & HWCAP_ARM_NEON) &&
+       (want != NULL) && (strcmp(want, "neon") == 0))
+#else
+   if ((want != NULL) && (strcmp(want, "neon") == 0))
+#endif
+   {
+      gKernel = ingest_neon;
+      gKernelName = "neon";
+   }
+#endif
+}
+
+/* HITS ------------------------------------------------------------------- */
+
+/*
+Trigger hits are indexed as samples arrive.  When a trigger is changed
+the index and the trigger counts are worked out again over every stored
+sample, a segment per job on a pool of worker threads, while the UI
+thread waits.  Only the UI thread changes the store so it is stable for
+the duration.
+*/
+
+static GThreadPool *gHitPool;
+static GMutex       gHitMutex;
+static GCond        gHitCond;
+static int          gHitPending;
+
+static void hits_job(gpointer data, gpointer user_data)
+{
+   piscopeHitJob_t *job;
+   piscopeSegment_t *seg;
+   int64_t tick[PISCOPE_BLOCK_SAMPLES];
+   uint32_t level[PISCOPE_BLOCK_SAMPLES];
+   uint32_t old, new, changed;
+   int64_t now;
+   int o, i, matched;
+
+   job = data;
+   seg = job->seg;
+
+   old = job->prevLevel;
+
+   for (o=0; o<job->end; o++)
+   {
+      if (seg->raw)
+      {
+         new = seg->raw->level[o];
+         now = seg->raw->tick[o];
+      }
+      else
+      {
+         /* each block is walked once in order, so it is unpacked whole
+            here rather than through the per thread block cache */
+
+         if (!(o & (PISCOPE_BLOCK_SAMPLES-1)))
+         {
+            store_unpackBlock
+               (seg->packed, o >> PISCOPE_BLOCK_SHIFT, tick, level);
+         }
+
+         new = level[o & (PISCOPE_BLOCK_SAMPLES-1)];
+         now = tick[o & (PISCOPE_BLOCK_SAMPLES-1)];
+      }
+
+      if (new == old) continue;
+
+      matched = engine_match(new, old) &
+                ((1<<PISCOPE_TRIGGERS)-1) & ~gIdleTriggers;
+
+      if (matched)
+      {
+         matched = engine_durations
+            (matched, now, job->prevTick, job->lastEdge);
+      }
+
+      /* as live, an idle hit is at the first sample past T */
+
+      if (gIdleTriggers)
+         matched |= engine_idle(old, now, job->prevTick, job->lastEdge);
+
+      for (changed = new ^ old; changed; changed &= (changed - 1))
+      {
+         job->lastEdge[__builtin_ctz(changed)] = now;
+      }
+
+      job->prevTick = now;
+
+      if (matched)
+      {
+         for (i=0; i<PISCOPE_TRIGGERS; i++)
+         {
+            if (matched & (1<<i)) job->count[i]++;
+         }
+
+         store_listAppend(&job->hit, &job->hits, &job->hitAlloc, o);
+      }
+
+      old = new;
+   }
+
+   g_mutex_lock(&gHitMutex);
+
+   if (--gHitPending == 0) g_cond_signal(&gHitCond);
+
+   g_mutex_unlock(&gHitMutex);
+}
+
+/* add a job for each segment of st, apart from those shared with gStore */
+
+static int hits_addJobs
+   (piscopeHitJob_t *jobs, piscopeStore_t *st, uint32_t timed)
+{
+   piscopeHitJob_t *job;
+   int64_t n, e;
+   int j, g, numJobs;
+
+   numJobs = 0;
+
+   for (j=0; j<st->numSegs; j++)
+   {
+      n = (st->firstSeg + j) << PISCOPE_SEG_SHIFT;
+
+      if ((st != &gStore) && (store_seg(st, n)->refs > 1)) continue;
+
+      job = &jobs[numJobs++];
+
+      job->st  = st;
+      job->seg = store_seg(st, n);
+
+      /* the oldest sample is never a hit */
+
+      if (n > st->first) job->prevLevel = store_level(st, n-1);
+      else               job->prevLevel = store_level(st, n);
+
+      /* the edges before the segment for duration conditions */
+
+      if (n > st->first) job->prevTick = store_tick(st, n-1);
+      else               job->prevTick = store_tick(st, n);
+
+      for (g=0; g<PISCOPE_GPIOS; g++)
+      {
+         job->lastEdge[g] = -1;
+
+         if ((timed & (1<<g)) && (n > st->first))
+         {
+            e = store_prevEdge(st, n-1, 1<<g);
+
+            if (e >= 0) job->lastEdge[g] = store_tick(st, e);
+         }
+      }
+
+      job->end = st->next - n;
+
+      if (job->end > PISCOPE_SEG_SAMPLES) job->end = PISCOPE_SEG_SAMPLES;
+   }
+
+   return numJobs;
+}
+
+/*
+Rebuild the hits of the store and of any snapshot being viewed.  The
+counts are those of the store.
+*/
+
+static void hits_rebuild(void)
+{
+   piscopeHitJob_t *jobs;
+   piscopeSegment_t *seg;
+   int i, j, numJobs;
+   uint32_t timed;
+
+   timed = 0;
+
+   for (i=0; i<PISCOPE_TRIGGERS; i++)
+   {
+      gTrigInfo[i].count = 0;
+
+      if (gTrigInfo[i].enabled) timed |= gTrigInfo[i].durationMask;
+   }
+
+   if (!(gStore.numSegs + gSnap.numSegs)) return;
+
+   if (!gHitPool)
+   {
+      gHitPool = g_thread_pool_new
+         (hits_job, NULL, g_get_num_processors(), FALSE, NULL);
+   }
+
+   jobs = g_malloc0
+      ((gStore.numSegs + gSnap.numSegs) * sizeof(piscopeHitJob_t));
+
+   numJobs  = hits_addJobs(jobs, &gStore, timed);
+   numJobs += hits_addJobs(jobs + numJobs, &gSnap, timed);
+
+   gHitPending = numJobs;
+
+   for (j=0; j<numJobs; j++) g_thread_pool_push(gHitPool, &jobs[j], NULL);
+
+   g_mutex_lock(&gHitMutex);
+
+   while (gHitPending) g_cond_wait(&gHitCond, &gHitMutex);
+
+   g_mutex_unlock(&gHitMutex);
+
+   for (j=0; j<numJobs; j++)
+   {
+      seg = jobs[j].seg;
+
+      jobs[j].st->bytes +=
+         (jobs[j].hitAlloc - seg->hitAlloc) * sizeof(uint16_t);
+
+      g_free(seg->hit);
+
+      seg->hit      = jobs[j].hit;
+      seg->hits     = jobs[j].hits;
+      seg->hitAlloc = jobs[j].hitAlloc;
+
+      if (jobs[j].st == &gStore)
+      {
+         for (i=0; i<PISCOPE_TRIGGERS; i++)
+            gTrigInfo[i].count += jobs[j].count[i];
+      }
+   }
+
+   g_free(jobs);
+}
+
+/* TRACE ------------------------------------------------------------------ */
+
+/*
+Each thread writes timed events into its own ring while tracing is on.
+The 't' key starts tracing, a second press stops it and writes the rings
+as a Chrome trace which chrome://tracing or Perfetto will load.  When
+tracing is off each trace point costs one load and a branch.
+*/
+
+typedef struct
+{
+   const char *name;
+   int64_t     start; /* monotonic nanos */
+   int64_t     dur;   /* nanos, -1 for a counter */
+   int64_t     arg;
+} piscopeTraceEvent_t;
+
+typedef struct
+{
+   const char          *thread;
+   piscopeTraceEvent_t *event;
+   volatile gint        next;
+   volatile gint        writers; /* in trace_add, see trace_stop */
+} piscopeTrace_t;
+
+static volatile gint  gTraceOn;
+static piscopeTrace_t gTraceUI      = {"ui"};
+static piscopeTrace_t gTraceCapture = {"capture"};
+
+static inline int64_t trace_now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return ((int64_t)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+/* the start of a traced span, 0 if tracing is off */
+
+static inline int64_t trace_begin(void)
+{
+   if (!g_atomic_int_get(&gTraceOn)) return 0;
+
+   return trace_now();
+}
+
+static void trace_add
+   (piscopeTrace_t *tr, const char *name, int64_t start, int64_t dur, int64_t arg)
+{
+   piscopeTraceEvent_t *ev;
+   gint next;
+
+   g_atomic_int_inc(&tr->writers);
+
+   if (g_atomic_int_get(&gTraceOn))
+   {
+      next = tr->next;
+
+      ev = &tr->event[next & (PISCOPE_TRACE_EVENTS - 1)];
+
+      ev->name  = name;
+      ev->start = start;
+      ev->dur   = dur;
+      ev->arg   = arg;
+
+      g_atomic_int_set(&tr->next, next + 1);
+   }
+
+   g_atomic_int_add(&tr->writers, -1);
+}
+
+static inline void trace_end
+   (piscopeTrace_t *tr, const char *name, int64_t start, int64_t arg)
+{
+   if (start) trace_add(tr, name, start, trace_now() - start, arg);
+}
+
+static inline void trace_counter
+   (piscopeTrace_t *tr, const char *name, int64_t value)
+{
+   if (g_atomic_int_get(&gTraceOn)) trace_add(tr, name, trace_now(), -1, value);
+}
+
+static void trace_start(void)
+{
+   if (!gTraceUI.event)
+   {
+      gTraceUI.event =
+         g_malloc(PISCOPE_TRACE_EVENTS * sizeof(piscopeTraceEvent_t));
+
+      gTraceCapture.event =
+         g_malloc(PISCOPE_TRACE_EVENTS * sizeof(piscopeTraceEvent_t));
+   }
+
+   g_atomic_int_set(&gTraceUI.next, 0);
+   g_atomic_int_set(&gTraceCapture.next, 0);
+
+   g_atomic_int_set(&gTraceOn, 1);
+}
+
+static void trace_write(FILE *out, piscopeTrace_t *tr, int tid, int *comma)
+{
+   piscopeTraceEvent_t *ev;
+   gint first, next, i;
+
+   fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+      "\"tid\":%d,\"args\":{\"name\":\"%s\"}}", *comma ? "," : "", tid, tr->thread);
+
+   *comma = 1;
+
+   next  = g_atomic_int_get(&tr->next);
+   first = next - PISCOPE_TRACE_EVENTS;
+
+   if (first < 0) first = 0;
+
+   for (i=first; i<next; i++)
+   {
+      ev = &tr->event[i & (PISCOPE_TRACE_EVENTS - 1)];
+
+      if (ev->dur < 0)
+      {
+         fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,"
+            "\"ts\":%.3f,\"args\":{\"value\":%lld}}",
+            ev->name, tid, ev->start / 1000.0, (long long)ev->arg);
+      }
+      else
+      {
+         fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+            "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"n\":%lld}}",
+            ev->name, tid, ev->start / 1000.0, ev->dur / 1000.0,
+            (long long)ev->arg);
+      }
+   }
+}
+
+/* stop tracing and write the events, returns 0 or an errno */
+
+static int trace_stop(char *filename)
+{
+   FILE *out;
+   int comma;
+
+   g_atomic_int_set(&gTraceOn, 0);
+
+   /* a capture thread event begun before the stop may still be being
+      added, once it is done no more are */
+
+   while (g_atomic_int_get(&gTraceCapture.writers)) g_thread_yield();
+
+   out = fopen(filename, "w");
+
+   if (out == NULL) return errno;
+
+   fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+   comma = 0;
+
+   trace_write(out, &gTraceUI, 1, &comma);
+   trace_write(out, &gTraceCapture, 2, &comma);
+
+   fprintf(out, "\n]}\n");
+
+   fclose(out);
+
+   return 0;
+}
+
+/* CAPTURE ---------------------------------------------------------------- */
+
+/*
+The capture thread blocks on the notification socket and copies whole
+reports into gCapRing.  The UI thread drains the ring in main_util_input
+so a slow redraw or a modal dialog never stops the socket being read.
+*/
+
+static void capture_publish(gpioReport_t *report, int count)
+{
+   guint head, tail, pos, chunk;
+   int stalled;
+
+   head = g_atomic_int_get(&gCapHead);
+
+   stalled = 0;
+
+   while (count)
+   {
+      tail = g_atomic_int_get(&gCapTail);
+
+      chunk = PISCOPE_CAPTURE_REPORTS - (head - tail);
+
+      if (!chunk)
+      {
+         /* UI is seconds behind, let pigpiod buffer the excess */
+
+         if (!g_atomic_int_get(&gCapRun)) return;
+
+         if (!stalled) g_atomic_int_inc(&gCapStalls);
+
+         stalled = 1;
+
+         g_usleep(1000);
+
+         continue;
+      }
+
+      if (chunk > count) chunk = count;
+
+      pos = head & (PISCOPE_CAPTURE_REPORTS - 1);
+
+      if (chunk > (PISCOPE_CAPTURE_REPORTS - pos))
+         chunk = PISCOPE_CAPTURE_REPORTS - pos;
+
+      memcpy(&gCapRing[pos], report, chunk * sizeof(gpioReport_t));
+
+      head   += chunk;
+      report += chunk;
+      count  -= chunk;
+
+      g_atomic_int_set(&gCapHead, head);
+   }
+}
+
+static gpointer capture_thread(gpointer user_data)
+{
+   struct timeval tv;
+   fd_set fds;
+   int fd, got, bytes, reports;
+   int64_t t;
+
+   fd = GPOINTER_TO_INT(user_data);
+
+   got = 0;
+
+   while (g_atomic_int_get(&gCapRun))
+   {
+      FD_ZERO(&fds);
+      FD_SET(fd, &fds);
+
+      tv.tv_sec  = 0;
+      tv.tv_usec = PISCOPE_CAPTURE_POLL_MS * 1000;
+
+      if (select(fd+1, &fds, NULL, NULL, &tv) != 1) continue;
+
+      t = trace_begin();
+
+      bytes = read(fd, (char*)&gReport+got, sizeof(gReport)-got);
+
+      trace_end(&gTraceCapture, "read", t, bytes);
+
+      if (bytes <= 0) break; /* pigpiod has closed the notification */
+
+      got += bytes;
+
+      reports = got / sizeof(gpioReport_t);
+
+      if (t && reports)
+      {
+         __atomic_store_n(&gCapArrival,
+            ((uint64_t)gReport[reports-1].tick << 32) |
+            (uint32_t)(trace_now() / 1000), __ATOMIC_RELAXED);
+      }
+
+      t = trace_begin();
+
+      capture_publish(gReport, reports);
+
+      trace_end(&gTraceCapture, "publish", t, reports);
+
+      /* copy any partial report to start of array */
+
+      got -= reports * sizeof(gpioReport_t);
+
+      if (got) memmove(gReport, &gReport[reports], got);
+   }
+
+   return NULL;
+}
+
+static void capture_start(int fd)
+{
+   g_atomic_int_set(&gCapHead, 0);
+   g_atomic_int_set(&gCapTail, 0);
+   g_atomic_int_set(&gCapRun,  1);
+
+   gCapThread = g_thread_new("capture", capture_thread, GINT_TO_POINTER(fd));
+}
+
+static void capture_stop(void)
+{
+   if (gCapThread)
+   {
+      g_atomic_int_set(&gCapRun, 0);
+
+      g_thread_join(gCapThread);
+
+      gCapThread = NULL;
+   }
+}
+
+/* PIGPIO ----------------------------------------------------------------- */
+
+static int pigpioCommand(int fd, int command, int p1, int p2)
+{
+   cmdCmd_t cmd;
+
+   if (fd < 0) return piscope_bad_socket;
+
+   cmd.cmd = command;
+   cmd.p1  = p1;
+   cmd.p2  = p2;
+   cmd.res = 0;
+
+   if (send(fd, &cmd, sizeof(cmdCmd_t), 0) != sizeof(cmdCmd_t))
+      return piscope_bad_send;
+
+   if (recv(fd, &cmd, sizeof(cmdCmd_t), MSG_WAITALL) != sizeof(cmdCmd_t))
+      return piscope_bad_recv;
+
+   return cmd.res;
+}
+
+/*
+Set a pigpiod watchdog on each gpio of an enabled idle trigger, so that
+a quiet gpio still sends a report just after T.  on 0 clears them.
+Watchdogs belong to the gpio, so they are cleared again on disconnect.
+*/
+
+static void pigpioSetWatchdogs(int on)
+{
+   static uint32_t set; /* gpios given a watchdog */
+
+   int i, g, ms, timeout[PISCOPE_GPIOS];
+   uint32_t want;
+
+   want = 0;
+
+   for (g=0; g<PISCOPE_GPIOS; g++) timeout[g] = 0;
+
+   for (i=0; on && (i<PISCOPE_TRIGGERS); i++)
+   {
+      if (!gTrigInfo[i].enabled) continue;
+
+      ms = (gTrigInfo[i].micros / 1000) + 1;
+
+      if (ms > PI_MAX_WDOG_TIMEOUT) ms = PI_MAX_WDOG_TIMEOUT;
+
+      for (g=0; g<PISCOPE_GPIOS; g++)
+      {
+         if ((gTrigInfo[i].idleMask & (1<<g)) &&
+             (!timeout[g] || (ms < timeout[g])))
+         {
+            timeout[g] = ms;
+            want |= (1<<g);
+         }
+      }
+   }
+
+   for (g=0; g<PISCOPE_GPIOS; g++)
+   {
+      if ((want | set) & (1<<g))
+         pigpioCommand(gPigSocket, PI_CMD_WDOG, g, timeout[g]);
+   }
+
+   set = want;
+}
+
+static void pigpioSetAddr(void)
+{
+   char * portStr, * addrStr;
+   char buf[16];
+
+   portStr = getenv(PI_ENVPORT);
+
+   if ((!portStr) || (!strlen(portStr)))
+   {
+      sprintf(buf, "%d", gSettings.port);
+      portStr = buf;
+   }
+
+   addrStr = getenv(PI_ENVADDR);
+
+   if ((!addrStr) || (!strlen(addrStr)))
+   {
+      addrStr=gSettings.serverAddress;
+   }
+
+   gtk_entry_set_text(GTK_ENTRY(gCmdsPigpioAddr), addrStr);
+
+   gtk_entry_set_text(GTK_ENTRY(gCmdsPigpioPort), portStr);
+
+   sprintf(buf, "%d", gSettings.bufferMB);
+
+   gtk_entry_set_text(GTK_ENTRY(gCmdsBufferMB), buf);
+
+   gtk_entry_set_text(GTK_ENTRY(gCmdsCaptureFile), gSettings.captureFile);
+
+   sprintf(buf, "%d", gSettings.captureMB);
+
+   gtk_entry_set_text(GTK_ENTRY(gCmdsCaptureMB), buf);
+
+   sprintf(buf, "%d", gSettings.frameRate);
+
+   gtk_entry_set_text(GTK_ENTRY(gCmdsFrameRate), buf);
+}
+
+static void pigpioLoadSettings(void)
+{
+   GKeyFile *cfg;
+   char *file, buf[50];
+   gint *tempList;
+   gboolean loaded;
+   int i, j, k, stages;
+   gsize len;
+   uint32_t levelMask, levelValue, changedMask;
+   piscopeSequenceSettings_t *seq;
+   GString *warn;
+
+   warn = g_string_new(NULL);
+
+   cfg = g_key_file_new();
+   file = g_build_filename(g_get_user_config_dir(), SETTINGS_FILE_NAME, NULL);
+
+   loaded = g_key_file_load_from_file(cfg, file, G_KEY_FILE_NONE, NULL);
+
+   g_free(gSettings.serverAddress);
+   g_free(gSettings.activeGPIOs);
+   g_free(gSettings.captureFile);
+   for(i=0; i<gSettings.counters; i++) g_free(gSettings.counter[i].name);
+   for(i=0; i<gSettings.sequences; i++) g_free(gSettings.sequence[i].name);
+   gSettings.counters=0;
+   gSettings.sequences=0;
+   gSettings.captureFile=NULL;
+   gSettings.serverAddress=NULL;
+   gSettings.activeGPIOs=NULL;
+   gSettings.activeGPIOCount=0;
+
+   if(loaded)
+   {
+      gSettings.serverAddress = g_key_file_get_string(cfg, SETTINGS_GROUP, SETTINGS_SERVER_ADDRESS, NULL);
+      gSettings.activeGPIOs = g_key_file_get_integer_list (cfg, SETTINGS_GROUP, SETTINGS_ACTIVE_GPIOS, &gSettings.activeGPIOCount, NULL);
+      gSettings.port = g_key_file_get_integer(cfg, SETTINGS_GROUP, SETTINGS_SERVER_PORT, NULL);
+      gSettings.triggerSamples = g_key_file_get_integer(cfg, SETTINGS_GROUP, SETTINGS_TRIGGER_SAMPLES, NULL);
+      gSettings.triggerWindows = g_key_file_get_integer(cfg, SETTINGS_GROUP, SETTINGS_TRIGGER_WINDOWS, NULL);
+      gSettings.triggerRepeat = g_key_file_get_integer(cfg, SETTINGS_GROUP, SETTINGS_TRIGGER_REPEAT, NULL);
+      gSettings.triggerHoldoff = g_key_file_get_integer(cfg, SETTINGS_GROUP, SETTINGS_TRIGGER_HOLDOFF, NULL);
+      gSettings.bufferMB = g_key_file_get_integer(cfg, SETTINGS_GROUP, SETTINGS_BUFFER_MB, NULL);
+      gSettings.captureFile = g_key_file_get_string(cfg, SETTINGS_GROUP, SETTINGS_CAPTURE_FILE, NULL);
+      gSettings.captureMB = g_key_file_get_integer(cfg, SETTINGS_GROUP, SETTINGS_CAPTURE_MB, NULL);
+      gSettings.frameRate = g_key_file_get_integer(cfg, SETTINGS_GROUP, SETTINGS_FRAME_RATE, NULL);
+      for(i=0; i<PISCOPE_TRIGGERS; i++)
+         {
+            sprintf(buf, SETTINGS_TRIGGER_ENABLED, i+1);
+            gSettings.triggers[i].enabled = g_key_file_get_boolean(cfg, SETTINGS_GROUP, buf, NULL);
+            sprintf(buf, SETTINGS_TRIGGER_ACTION, i+1);
+            gSettings.triggers[i].action = g_key_file_get_integer(cfg, SETTINGS_GROUP, buf, NULL);
+            sprintf(buf, SETTINGS_TRIGGER_MICROS, i+1);
+            gSettings.triggers[i].micros = g_key_file_get_integer(cfg, SETTINGS_GROUP, buf, NULL);
+            sprintf(buf, SETTINGS_TRIGGER_GPIO_TYPES, i+1);
+            tempList = g_key_file_get_integer_list(cfg, SETTINGS_GROUP, buf, &len, NULL);
+            if(tempList)
+               {
+                  for(j=0; j<len && j<PISCOPE_GPIOS; j++)
+                     {
+                        gSettings.triggers[i].gpiotypes[j] = tempList[j];
+                     }
+               }
+            g_free(tempList);
+         }
+      /* named count only triggers, only set by editing the file */
+      for(i=0; i<PISCOPE_COUNTERS; i++)
+         {
+            sprintf(buf, SETTINGS_COUNTER_NAME, i+1);
+            if(!g_key_file_has_key(cfg, SETTINGS_GROUP, buf, NULL)) break;
+            memset(&gSettings.counter[i], 0, sizeof(piscopeCounterSettings_t));
+            gSettings.counter[i].name = g_key_file_get_string(cfg, SETTINGS_GROUP, buf, NULL);
+            sprintf(buf, SETTINGS_COUNTER_GPIO_TYPES, i+1);
+            tempList = g_key_file_get_integer_list(cfg, SETTINGS_GROUP, buf, &len, NULL);
+            if(tempList)
+               {
+                  for(j=0; j<len && j<PISCOPE_GPIOS; j++)
+                     {
+                        gSettings.counter[i].gpiotypes[j] = tempList[j];
+                     }
+               }
+            g_free(tempList);
+            gSettings.counters = i+1;
+         }
+      /* sequence triggers, likewise */
+      for(i=0; i<PISCOPE_SEQUENCES; i++)
+         {
+            sprintf(buf, SETTINGS_SEQUENCE_NAME, i+1);
+            if(!g_key_file_has_key(cfg, SETTINGS_GROUP, buf, NULL)) break;
+            seq = &gSettings.sequence[i];
+            memset(seq, 0, sizeof(piscopeSequenceSettings_t));
+            seq->name = g_key_file_get_string(cfg, SETTINGS_GROUP, buf, NULL);
+            sprintf(buf, SETTINGS_SEQUENCE_ACTION, i+1);
+            seq->action = g_key_file_get_integer(cfg, SETTINGS_GROUP, buf, NULL);
+            for(k=0; k<PISCOPE_STAGES; k++)
+               {
+                  sprintf(buf, SETTINGS_STAGE_GPIO_TYPES, i+1, k+1);
+                  tempList = g_key_file_get_integer_list(cfg, SETTINGS_GROUP, buf, &len, NULL);
+                  if(!tempList) break;
+                  for(j=0; j<len && j<PISCOPE_GPIOS; j++)
+                     seq->stage[k].gpiotypes[j] = tempList[j];
+                  g_free(tempList);
+                  /* a stage with nothing to match could never complete */
+                  util_compileGPIOTypes(seq->stage[k].gpiotypes, &levelMask, &levelValue, &changedMask);
+                  if(!(levelMask | changedMask))
+                     {
+                        g_string_append_printf(warn, "%s stage %d has no gpio conditions, it and any later stages are ignored.\n", seq->name, k+1);
+                        break;
+                     }
+                  sprintf(buf, SETTINGS_STAGE_HOLD_TYPES, i+1, k+1);
+                  tempList = g_key_file_get_integer_list(cfg, SETTINGS_GROUP, buf, &len, NULL);
+                  for(j=0; tempList && j<len && j<PISCOPE_GPIOS; j++)
+                     seq->stage[k].holdtypes[j] = tempList[j];
+                  g_free(tempList);
+                  sprintf(buf, SETTINGS_STAGE_REPEAT, i+1, k+1);
+                  seq->stage[k].repeat = g_key_file_get_integer(cfg, SETTINGS_GROUP, buf, NULL);
+                  sprintf(buf, SETTINGS_STAGE_WITHIN, i+1, k+1);
+                  seq->stage[k].within = g_key_file_get_integer(cfg, SETTINGS_GROUP, buf, NULL);
+                  seq->stages = k+1;
+               }
+            if ((seq->action < piscope_count) || (seq->action > piscope_sample_to))
+               seq->action = piscope_count;
+            if(!seq->stages)
+               g_string_append_printf(warn, "%s has no stages and will never fire.\n", seq->name);
+            gSettings.sequences = i+1;
+         }
+      /* each stage takes an engine entry after the triggers and counters */
+      stages = 0;
+      for(i=0; i<gSettings.sequences; i++) stages += gSettings.sequence[i].stages;
+      if(gSettings.counters > (PISCOPE_COUNTERS - stages))
+         {
+            g_string_append_printf(warn, "Only %d counters fit beside the sequence stages, the rest are ignored.\n", PISCOPE_COUNTERS - stages);
+            for(i=PISCOPE_COUNTERS - stages; i<gSettings.counters; i++) g_free(gSettings.counter[i].name);
+            gSettings.counters = PISCOPE_COUNTERS - stages;
+         }
+   }
+
+   if (gSettings.bufferMB < PISCOPE_MIN_BUFFER_MB)
+      gSettings.bufferMB = PISCOPE_DEF_BUFFER_MB;
+
+   if (gSettings.bufferMB > PISCOPE_MAX_BUFFER_MB)
+      gSettings.bufferMB = PISCOPE_MAX_BUFFER_MB;
+
+   if (gSettings.captureMB < PISCOPE_MIN_CAPTURE_MB)
+      gSettings.captureMB = PISCOPE_MIN_CAPTURE_MB;
+
+   if (gSettings.captureMB > PISCOPE_MAX_CAPTURE_MB)
+      gSettings.captureMB = PISCOPE_MAX_CAPTURE_MB;
+
+   if (gSettings.frameRate < PISCOPE_MIN_FRAME_RATE)
+      gSettings.frameRate = PISCOPE_DEF_FRAME_RATE;
+
+   if (gSettings.frameRate > PISCOPE_MAX_FRAME_RATE)
+      gSettings.frameRate = PISCOPE_MAX_FRAME_RATE;
+
+   if (!gSettings.captureFile) gSettings.captureFile = g_strdup("");
+
+   if(!gSettings.serverAddress)
+   {
+      gSettings.serverAddress = g_malloc(sizeof(PI_DEFAULT_SERVER_ADDRESS));
+      strcpy (gSettings.serverAddress, PI_DEFAULT_SERVER_ADDRESS);
+      gSettings.port = PI_DEFAULT_SOCKET_PORT;
+   }
+
+   if(warn->len)
+      util_popupMessage(GTK_MESSAGE_WARNING, GTK_BUTTONS_CLOSE, "%s\n\n%s", file, warn->str);
+
+   g_string_free(warn, TRUE);
+   g_free(file);
+   g_key_file_free(cfg);
+}
+
+static void pigpioSaveSettings(void)
+{
+   GKeyFile * cfg;
+   char * file, buf[50];
+   int i, k;
+   piscopeSequenceSettings_t *seq;
+
+   cfg = g_key_file_new();
+   file = g_build_filename(g_get_user_config_dir(), SETTINGS_FILE_NAME, NULL);
+
+   g_key_file_set_string(cfg, SETTINGS_GROUP, SETTINGS_SERVER_ADDRESS, gSettings.serverAddress);
+   g_key_file_set_integer(cfg, SETTINGS_GROUP, SETTINGS_SERVER_PORT, gSettings.port);
+   if(gSettings.activeGPIOs)
+      g_key_file_set_integer_list(cfg, SETTINGS_GROUP, SETTINGS_ACTIVE_GPIOS, gSettings.activeGPIOs, gSettings.activeGPIOCount);
+
+   g_key_file_set_integer(cfg, SETTINGS_GROUP, SETTINGS_TRIGGER_SAMPLES, gSettings.triggerSamples);
+   g_key_file_set_integer(cfg, SETTINGS_GROUP, SETTINGS_TRIGGER_WINDOWS, gSettings.triggerWindows);
+   g_key_file_set_integer(cfg, SETTINGS_GROUP, SETTINGS_TRIGGER_REPEAT, gSettings.triggerRepeat);
+   g_key_file_set_integer(cfg, SETTINGS_GROUP, SETTINGS_TRIGGER_HOLDOFF, gSettings.triggerHoldoff);
+   g_key_file_set_integer(cfg, SETTINGS_GROUP, SETTINGS_BUFFER_MB, gSettings.bufferMB);
+   g_key_file_set_string(cfg, SETTINGS_GROUP, SETTINGS_CAPTURE_FILE, gSettings.captureFile);
+   g_key_file_set_integer(cfg, SETTINGS_GROUP, SETTINGS_CAPTURE_MB, gSettings.captureMB);
+   g_key_file_set_integer(cfg, SETTINGS_GROUP, SETTINGS_FRAME_RATE, gSettings.frameRate);
+   for(i=0; i<PISCOPE_TRIGGERS; i++)
+      {
+         sprintf(buf, SETTINGS_TRIGGER_ENABLED, i+1);
+         g_key_file_set_boolean(cfg, SETTINGS_GROUP, buf, gSettings.triggers[i].enabled);
+         sprintf(buf, SETTINGS_TRIGGER_ACTION, i+1);
+         g_key_file_set_integer(cfg, SETTINGS_GROUP, buf, gSettings.triggers[i].action);
+         sprintf(buf, SETTINGS_TRIGGER_MICROS, i+1);
+         g_key_file_set_integer(cfg, SETTINGS_GROUP, buf, gSettings.triggers[i].micros);
+         sprintf(buf, SETTINGS_TRIGGER_GPIO_TYPES, i+1);
+         g_key_file_set_integer_list(cfg, SETTINGS_GROUP, buf, gSettings.triggers[i].gpiotypes, PISCOPE_GPIOS);
+      }
+   for(i=0; i<gSettings.counters; i++)
+      {
+         sprintf(buf, SETTINGS_COUNTER_NAME, i+1);
+         g_key_file_set_string(cfg, SETTINGS_GROUP, buf, gSettings.counter[i].name);
+         sprintf(buf, SETTINGS_COUNTER_GPIO_TYPES, i+1);
+         g_key_file_set_integer_list(cfg, SETTINGS_GROUP, buf, gSettings.counter[i].gpiotypes, PISCOPE_GPIOS);
+      }
+   for(i=0; i<gSettings.sequences; i++)
+      {
+         seq = &gSettings.sequence[i];
+         sprintf(buf, SETTINGS_SEQUENCE_NAME, i+1);
+         g_key_file_set_string(cfg, SETTINGS_GROUP, buf, seq->name);
+         sprintf(buf, SETTINGS_SEQUENCE_ACTION, i+1);
+         g_key_file_set_integer(cfg, SETTINGS_GROUP, buf, seq->action);
+         for(k=0; k<seq->stages; k++)
+            {
+               sprintf(buf, SETTINGS_STAGE_GPIO_TYPES, i+1, k+1);
+               g_key_file_set_integer_list(cfg, SETTINGS_GROUP, buf, seq->stage[k].gpiotypes, PISCOPE_GPIOS);
+               sprintf(buf, SETTINGS_STAGE_HOLD_TYPES, i+1, k+1);
+               g_key_file_set_integer_list(cfg, SETTINGS_GROUP, buf, seq->stage[k].holdtypes, PISCOPE_GPIOS);
+               sprintf(buf, SETTINGS_STAGE_REPEAT, i+1, k+1);
+               g_key_file_set_integer(cfg, SETTINGS_GROUP, buf, seq->stage[k].repeat);
+               sprintf(buf, SETTINGS_STAGE_WITHIN, i+1, k+1);
+               g_key_file_set_integer(cfg, SETTINGS_GROUP, buf, seq->stage[k].within);
+            }
+      }
+   g_key_file_save_to_file(cfg, file, NULL);
+
+   g_free(file);
+   g_key_file_free(cfg);
+}
+
+static int cmpfunc(const void * a, const void * b) {
+   return ( *(int*)a - *(int*)b );
+}
+
+static void pigpioSetGpios(void)
+{
+   int i, hwver;
+   uint32_t notifyBits = 0;
+
+   gDisplayedGpios = 0;
+
+   hwver = pigpioCommand(gPigSocket, PI_CMD_HWVER, 0, 0);
+
+   if      (hwver <  0) gRPiRevision = 0;
+   else if (hwver <  4) gRPiRevision = 1;
+   else if (hwver < 16) gRPiRevision = 2;
+   else                 gRPiRevision = 3;
+
+   for (i=0; i<PISCOPE_GPIOS; i++)
+   {
+      gGpioInfo[i].display = 0;
+
+      switch (gRPiRevision)
+      {
+         case 1:
+         case 2:
+         case 3:
+            gGpioInfo[i].name = gGpioUsage[gRPiRevision-1][i].name;
+
+            if (gGpioUsage[gRPiRevision-1][i].usable && (!gSettings.activeGPIOs ||
+                  bsearch(&i, gSettings.activeGPIOs, gSettings.activeGPIOCount, sizeof (int), cmpfunc)))
+               gGpioInfo[i].display = 1;
+
+            break;
+
+         default:
+            gGpioInfo[i].name = NULL;
+            gGpioInfo[i].display = 1;
+      }
+
+      if (gGpioInfo[i].display)
+      {
+         gDisplayedGpios++;
+         notifyBits |= (1<<i);
+      }
+
+      gtk_toggle_button_set_active(
+         gGpioInfo[i].button, gGpioInfo[i].display);
+   }
+
+   pigpioCommand(gPigSocket, PI_CMD_NB, gPigHandle, notifyBits);
+}
+
+static void util_setTriggerGPIOTypes(int triggerNum)
+{
+   int i;
+
+   for (i=0; i<PISCOPE_GPIOS; i++)
+   {
+      gTrigInfo[triggerNum].type[i] = gSettings.triggers[triggerNum].gpiotypes[i];
+   }
+
+   util_compileGPIOTypes(gSettings.triggers[triggerNum].gpiotypes,
+      &gTrigInfo[triggerNum].levelMask,
+      &gTrigInfo[triggerNum].levelValue,
+      &gTrigInfo[triggerNum].changedMask);
+
+   gTrigInfo[triggerNum].durationMask = 0;
+   gTrigInfo[triggerNum].idleMask     = 0;
+
+   for (i=0; i<PISCOPE_GPIOS; i++)
+   {
+      if (gTrigInfo[triggerNum].type[i] >= piscope_high_gt)
+         gTrigInfo[triggerNum].durationMask |= (1<<i);
+
+      if (gTrigInfo[triggerNum].type[i] == piscope_idle_gt)
+         gTrigInfo[triggerNum].idleMask |= (1<<i);
+   }
+
+   gTrigInfo[triggerNum].micros = gSettings.triggers[triggerNum].micros;
+
+   engine_compile();
+
+   pigpioSetWatchdogs(1);
+}
+
+static void pigpioSetTriggers(void)
+{
+   int i;
+   char buf[32];
+
+   sscanf(gTrigSamplesText[gSettings.triggerSamples], "%d", &gTrigSamples);
+   gtk_combo_box_set_active(GTK_COMBO_BOX(gTrgsSamples),  gSettings.triggerSamples);
+
+   if ((gSettings.triggerWindows < 0) || (gSettings.triggerWindows >=
+       sizeof(gTrigWindowsText)/sizeof(gTrigWindowsText[0])))
+      gSettings.triggerWindows = 0;
+
+   sscanf(gTrigWindowsText[gSettings.triggerWindows], "%d", &gTrigWindows);
+   gtk_combo_box_set_active(GTK_COMBO_BOX(gTrgsWindows),  gSettings.triggerWindows);
+
+   if ((gSettings.triggerRepeat < 0) || (gSettings.triggerRepeat >=
+       sizeof(gTrigRepeatText)/sizeof(gTrigRepeatText[0])))
+      gSettings.triggerRepeat = 0;
+
+   if (gSettings.triggerHoldoff < 0) gSettings.triggerHoldoff = 0;
+
+   gTrigRepeat = gSettings.triggerRepeat;
+   gtk_combo_box_set_active(GTK_COMBO_BOX(gTrgsRepeat), gTrigRepeat);
+
+   sprintf(buf, "%d", gSettings.triggerHoldoff);
+   gtk_entry_set_text(GTK_ENTRY(gTrgsHoldoff), buf);
+   gTrigHoldoff = gSettings.triggerHoldoff;
+
+   for(i=0; i<PISCOPE_TRIGGERS; i++)
+   {
+      gTrigInfo[i].enabled = gSettings.triggers[i].enabled;
+      gTrigInfo[i].when = gSettings.triggers[i].action;
+      util_setTriggerGPIOTypes(i);
+
+      gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(gTrigInfo[i].onW), gTrigInfo[i].enabled);
+      gtk_combo_box_set_active(GTK_COMBO_BOX(gTrigInfo[i].whenW), gTrigInfo[i].when);
+   }
+}
+
+static void pigpioSetState(void)
+{
+   if (gPigConnected)
+   {
+      gtk_toggle_tool_button_set_active(
+         GTK_TOGGLE_TOOL_BUTTON(gMainTBconnect), TRUE);
+
+      gtk_toggle_tool_button_set_active(
+         GTK_TOGGLE_TOOL_BUTTON(gMainTBlive), TRUE);
+   }
+   else
+   {
+      gtk_toggle_tool_button_set_active(
+         GTK_TOGGLE_TOOL_BUTTON(gMainTBconnect), FALSE);
+
+      gtk_toggle_tool_button_set_active(
+         GTK_TOGGLE_TOOL_BUTTON(gMainTBpause), TRUE);
+   }
+
+   main_util_setWindowTitle();
+   
+   util_zoom_def_clicked();
+}
+
+static int pigpioOpenSocket(void)
+{
+   int sock, err;
+   struct addrinfo hints, *res, *rp;
+   const gchar *addrStr, *portStr;
+
+   addrStr = gtk_entry_get_text(GTK_ENTRY(gCmdsPigpioAddr));
+
+   portStr = gtk_entry_get_text(GTK_ENTRY(gCmdsPigpioPort));
+
+   memset (&hints, 0, sizeof (hints));
+
+   hints.ai_family   = PF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+   hints.ai_flags   |= AI_CANONNAME;
+
+   err = getaddrinfo (addrStr, portStr, &hints, &res);
+
+   if (err) return piscope_bad_getaddrinfo;
+
+   for (rp=res; rp!=NULL; rp=rp->ai_next)
+   {
+      sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+
+      if (sock == -1) continue;
+
+      if (connect(sock, rp->ai_addr, rp->ai_addrlen) != -1) break;
+   }
+
+   freeaddrinfo(res);
+
+   if (rp == NULL) return piscope_bad_connect;
+
+   return sock;
+}
+
+static int pigpioOpenNotifications(void)
+{
+   int r;
+
+   gPigNotify = pigpioOpenSocket();
+
+   if (gPigNotify < 0) return piscope_bad_nsock;
+
+   r = pigpioCommand(gPigNotify, PI_CMD_NOIB, 0, 0);
+
+   if (r < 0) return piscope_bad_noib;
+
+   gPigHandle = r;
+
+   capture_start(gPigNotify);
+
+   return 0;
+}
+
+static void pigpioConnect(void)
+{
+   char msg[256];
+
+   if (!gPigConnected)
+   {
+      store_reset(&gStore);
+
+      if (gView != &gStore) store_setView(1);
+
+      gWindows = 0;
+      gWindowShown = -1;
+
+      gPigSocket = pigpioOpenSocket();
+
+      if (gPigSocket >= 0)
+      {
+         gPigConnected = 1;
+
+         pigpioOpenNotifications();
+
+         gInputState = piscope_initialise;
+      }
+      else
+      {
+         gPigConnected = 0;
+
+         snprintf(msg, sizeof(msg),
+            "Can't connect to pigpio at %s.\nDid you sudo pigpiod?\nIf you are on a remote client, have you set the server address and port?",
+             gtk_entry_get_text(GTK_ENTRY(gCmdsPigpioAddr)));
+         
+         util_popupMessage(GTK_MESSAGE_WARNING, GTK_BUTTONS_CLOSE, msg);
+      }
+
+      pigpioSetGpios();
+
+      pigpioSetTriggers();
+
+      pigpioSetState();
+
+      util_calcGpioY();
+   }
+}
+
+static void pigpioDisconnect(void)
+{
+   if (gPigConnected)
+   {
+      gInputState = piscope_dormant;
+
+      gPigConnected = 0;
+
+      capture_stop();
+
+      if (gPigSocket >= 0)
+      {
+         pigpioSetWatchdogs(0);
+
+         if (gPigHandle >= 0)
+         {
+            pigpioCommand(gPigSocket, PI_CMD_NC, gPigHandle, 0);
+            gPigHandle = -1;
+         }
+
+         close(gPigSocket);
+         gPigSocket = -1;
+      }
+
+      if (gPigNotify >= 0)
+      {
+         close(gPigNotify);
+         gPigNotify = -1;
+      }
+
+      pigpioSetGpios();
+
+      pigpioSetState();
+
+      util_calcGpioY();
+   }
+}
+
+/* CMDS ------------------------------------------------------------------- */
+
+void cmds_clear_triggers_clicked(GtkButton * button, gpointer user_data)
+{
+   int i;
+
+   for (i=0; i<PISCOPE_TRIGGERS; i++) gTrigInfo[i].count = 0;
+
+   for (i=0; i<PISCOPE_COUNTERS; i++) gCounterCount[i] = 0;
+
+   for (i=0; i<PISCOPE_SEQUENCES; i++) gSequence[i].count = 0;
+}
+
+static void cmds_clearSamples(void)
+{
+   store_reset(&gStore);
+
+   if (gView != &gStore) store_setView(1);
+
+   gWindows = 0;
+   gWindowShown = -1;
+
+   gBlueTick = 0;
+   gGoldTick = 0;
+   g1Tick = 0;
+   g2Tick = 0;
+
+   gTickOrigin = 0;
+
+   main_osc_configure_event(gMainCosc, NULL, NULL);
+}
+
+static void cmds_storeInit(void)
+{
+   int err;
+
+   if (gSettings.captureFile[0])
+   {
+      err = store_init(&gStore, gSettings.captureMB, gSettings.captureFile);
+
+      if (err)
+      {
+         util_popupMessage(GTK_MESSAGE_WARNING, GTK_BUTTONS_CLOSE,
+            "Can't map capture file %s (%s).\nUsing a %d MB memory buffer.",
+            gSettings.captureFile, strerror(err), gSettings.bufferMB);
+
+         g_free(gSettings.captureFile);
+         gSettings.captureFile = g_strdup("");
+      }
+   }
+
+   if (!gSettings.captureFile[0])
+      store_init(&gStore, gSettings.bufferMB, NULL);
+}
+
+void cmds_close_clicked(GtkButton * button, gpointer user_data)
+{
+   const char *serverAddress, *captureFile;
+   char msg[128];
+   int bufferMB, captureMB, frameRate;
+   
+   gtk_widget_hide(gCmdsDialog);
+
+   bufferMB = strtol(gtk_entry_get_text(GTK_ENTRY(gCmdsBufferMB)), NULL, 10);
+
+   if (bufferMB < PISCOPE_MIN_BUFFER_MB) bufferMB = PISCOPE_MIN_BUFFER_MB;
+   if (bufferMB > PISCOPE_MAX_BUFFER_MB) bufferMB = PISCOPE_MAX_BUFFER_MB;
+
+   captureMB = strtol(gtk_entry_get_text(GTK_ENTRY(gCmdsCaptureMB)), NULL, 10);
+
+   if (captureMB < PISCOPE_MIN_CAPTURE_MB) captureMB = PISCOPE_MIN_CAPTURE_MB;
+   if (captureMB > PISCOPE_MAX_CAPTURE_MB) captureMB = PISCOPE_MAX_CAPTURE_MB;
+
+   captureFile = gtk_entry_get_text(GTK_ENTRY(gCmdsCaptureFile));
+
+   if ((bufferMB != gSettings.bufferMB) ||
+       strcmp(captureFile, gSettings.captureFile) ||
+       (captureFile[0] && (captureMB != gSettings.captureMB)))
+   {
+      if (util_popupMessage(GTK_MESSAGE_QUESTION,
+                       GTK_BUTTONS_YES_NO,
+                       "Change the sample buffer?\n"
+                       "All samples will be cleared.") == GTK_RESPONSE_YES)
+      {
+         gSettings.bufferMB  = bufferMB;
+         gSettings.captureMB = captureMB;
+
+         g_free(gSettings.captureFile);
+         gSettings.captureFile = g_strdup(captureFile);
+
+         cmds_storeInit();
+
+         cmds_clearSamples();
+      }
+   }
+
+   snprintf(msg, sizeof(msg), "%d", gSettings.bufferMB);
+   gtk_entry_set_text(GTK_ENTRY(gCmdsBufferMB), msg);
+
+   snprintf(msg, sizeof(msg), "%d", gSettings.captureMB);
+   gtk_entry_set_text(GTK_ENTRY(gCmdsCaptureMB), msg);
+
+   frameRate = strtol(gtk_entry_get_text(GTK_ENTRY(gCmdsFrameRate)), NULL, 10);
+
+   if (frameRate < PISCOPE_MIN_FRAME_RATE) frameRate = PISCOPE_MIN_FRAME_RATE;
+   if (frameRate > PISCOPE_MAX_FRAME_RATE) frameRate = PISCOPE_MAX_FRAME_RATE;
+
+   gSettings.frameRate = frameRate;
+
+   main_util_frameRate(frameRate);
+
+   snprintf(msg, sizeof(msg), "%d", gSettings.frameRate);
+   gtk_entry_set_text(GTK_ENTRY(gCmdsFrameRate), msg);
+
+   gtk_entry_set_text(GTK_ENTRY(gCmdsCaptureFile), gSettings.captureFile);
+
+   if (gSettings.serverAddress)
+   {
+      g_free(gSettings.serverAddress);
+      gSettings.serverAddress=NULL;
+   }
+   serverAddress = gtk_entry_get_text(GTK_ENTRY(gCmdsPigpioAddr));
+   gSettings.serverAddress = g_malloc(strlen(serverAddress)+1);
+   strcpy(gSettings.serverAddress, serverAddress);
+   gSettings.port = strtol(gtk_entry_get_text(GTK_ENTRY(gCmdsPigpioPort)), NULL, 10);
+   
+   if (!gPigConnected)
+   {
+      snprintf(msg, sizeof(msg), "Connect to pigpio at %s", serverAddress);
+      gtk_widget_set_tooltip_text(GTK_WIDGET(gMainTBconnect), msg);
+   }
+
+   pigpioSaveSettings();
+}
+
+void cmds_emptybuf_clicked(GtkButton * button, gpointer user_data)
+{
+   if (util_popupMessage(GTK_MESSAGE_QUESTION,
+                    GTK_BUTTONS_YES_NO,
+                    "Clear all samples?") ==  GTK_RESPONSE_YES)
+   {
+      cmds_clearSamples();
+   }
+}
+
+void cmds_playspeed_changed(GtkComboBox *widget, gpointer user_data)
+{
+   gPlaySpeed = gtk_combo_box_get_active(widget);
+
+   if (gMode == piscope_play) util_setViewMode(piscope_play);
+}
+
+/* FILE ------------------------------------------------------------------- */
+
+static int file_VCDsymbol(int bit)
+{
+   if (bit < 26) return ('A' + bit);
+   else          return ('a' + bit - 26);
+}
+
+static int file_load(char *filename)
+{
+   uint32_t level;
+   int64_t tick64;
+   int err;
+   FILE * in;
+   time_t time;
+   struct tm cal;
+   char buf[512];
+
+   err = 1;
+
+   in = fopen(filename, "r");
+
+   if (in == NULL) return errno;
+
+   if (fgets(buf, 32, in))
+   {
+      if (strcmp(buf, "#piscope\n") == 0)
+      {
+         if (fgets(buf, 64, in))
+         {
+            if (strncmp(buf, "#date ", 6) == 0)
+            {
+               sscanf(buf, "#date %d-%d-%d %d:%d:%d",
+                  &cal.tm_year, &cal.tm_mon, &cal.tm_mday,
+                  &cal.tm_hour, &cal.tm_min, &cal.tm_sec);
+
+               /* need tm_mon in 0..11 */
+               --cal.tm_mon;
+
+               /* need tm_year from 1900 */
+               cal.tm_year -= 1900;
+
+               time = mktime(&cal);
+
+               gTimeOrigin.tv_sec  = time;
+               gTimeOrigin.tv_usec = 0;
+
+               gTickOrigin = 0;
+               gGoldTick   = 0;
+
+               err = 0;
+
+               store_reset(&gStore);
+
+               gWindows = 0;
+               gWindowShown = -1;
+
+               while (fscanf(in, "%Ld %08X\n",
+                        (long long int *) &tick64, &level) == 2)
+               {
+                  /* keep what fits */
+
+                  if (store_append(&gStore, tick64, level, 0) < 0) break;
+               }
+            }
+         }
+      }
+   }
+
+   if (err)
+   {
+      util_popupMessage
+      (
+         GTK_MESSAGE_WARNING, GTK_BUTTONS_CLOSE,
+         "%s\nis not a legal .piscope file",
+         filename
+      );
+   }
+
+   fclose(in);
+
+   if (gView != &gStore) store_setView(1);
+
+   /* index the trigger hits of the loaded samples */
+
+   hits_rebuild();
+
+   return 0;
+}
+
+static int file_save(int filetype, char *filename, int selection)
+{
+   int b, v;
+   int64_t n, tick;
+   uint32_t lastLevel, changed, level;
+   FILE * out;
+
+   out = fopen(filename, "w");
+
+   if (out == NULL) return errno;
+
+   if (filetype == piscope_vcd)
+   {
+      fprintf(out, "$date %s $end\n", util_timeStamp(&gTickOrigin, 0, 0));
+      fprintf(out, "$version piscope V1 $end\n");
+      fprintf(out, "$timescale 1 us $end\n");
+      fprintf(out, "$scope module top $end\n");
+
+      for (b=0; b<32; b++)
+         fprintf(out, "$var wire 1 %c %d $end\n", file_VCDsymbol(b), b);
+
+      fprintf(out, "$upscope $end\n");
+      fprintf(out, "$enddefinitions $end\n");
+   }
+   else
+   {
+      fprintf(out, "#piscope\n");
+      fprintf(out, "#date %s\n", util_timeStamp(&gTickOrigin, 0, 0));
+   }
+
+   if (gView->next == gView->first)
+   {
+      fclose(out);
+
+      return 0;
+   }
+
+   lastLevel = ~store_level(gView, gView->first);
+
+   for (n=gView->first; n<gView->next; n++)
+   {
+      tick  = store_tick(gView, n);
+      level = store_level(gView, n);
+
+      if (!selection || ((tick >= g1Tick) && (tick <= g2Tick)))
+      {
+         if (filetype == piscope_vcd)
+         {
+            fprintf(out, "#%Ld\n", (long long int)(tick-gTickOrigin));
+
+            changed = level ^ lastLevel;
+
+            for (b=0; b<32; b++)
+            {
+               if (changed & (1<<b))
+               {
+                  if (level & (1<<b)) v='1'; else v='0';
+
+                  fprintf(out, "%c%c\n", v, file_VCDsymbol(b));
+               }
+            }
+
+            lastLevel = level;
+         }
+         else
+         {
+            fprintf
+            (
+               out,
+               "%Ld %08X\n",
+               (long long int)(tick-gTickOrigin),
+               level
+            );
+         }
+      }
+   }
+
+   fclose(out);
+
+   return 0;
+}
+
+/* GPIO ------------------------------------------------------------------- */
+
+void gpio_clear_all(GtkButton * button, gpointer user_data)
+{
+   int i;
+   /* clear states */
+   for (i=0; i<PISCOPE_GPIOS; i++)
+   {
+      gtk_toggle_button_set_active(gGpioInfo[i].button, FALSE);
+   }
+}
+
+void gpio_set_all(GtkButton * button, gpointer user_data)
+{
+   int i;
+   /* set states */
+   for (i=0; i<PISCOPE_GPIOS; i++)
+   {
+      gtk_toggle_button_set_active(gGpioInfo[i].button, TRUE);
+   }
+}
+
+void gpio_invert_all(GtkButton * button, gpointer user_data)
+{
+   int i;
+   /* invert states */
+   for (i=0; i<PISCOPE_GPIOS; i++)
+   {
+      if (gtk_toggle_button_get_active(gGpioInfo[i].button))
+         gtk_toggle_button_set_active(gGpioInfo[i].button, FALSE);
+      else
+         gtk_toggle_button_set_active(gGpioInfo[i].button, TRUE);      
+   }
+}
+
+void gpio_apply_clicked(GtkButton * button, gpointer user_data)
+{
+   int i;
+   uint32_t notifyBits = 0;
+
+   gtk_widget_hide(gGpioDialog);
+
+   /* get and set states */
+
+   g_free(gSettings.activeGPIOs);
+   gSettings.activeGPIOCount = gDisplayedGpios = 0;
+   gSettings.activeGPIOs = g_malloc(PISCOPE_GPIOS * sizeof(gint));
+
+   for (i=0; i<PISCOPE_GPIOS; i++)
+   {
+      gGpioInfo[i].display =
+         gtk_toggle_button_get_active(gGpioInfo[i].button);
+
+      if (gGpioInfo[i].display)
+      {
+         gSettings.activeGPIOs[gSettings.activeGPIOCount++] = i;
+         gDisplayedGpios++;
+
+         notifyBits |= (1<<i);
+      }
+   }
+
+   if (gDisplayedGpios == 0)
+   {
+      /* not worth the hassle of allowing zero gpios,
+         arbitrarily display gpio#0 */
+
+      gDisplayedGpios      = 1;
+      gGpioInfo[0].display = 1;
+      gSettings.activeGPIOs[0] = 0;
+      gSettings.activeGPIOCount = 1;
+   }
+
+   pigpioCommand(gPigSocket, PI_CMD_NB, gPigHandle, notifyBits);
+
+   util_calcGpioY();
+
+   pigpioSaveSettings();
+}
+
+void gpio_cancel_clicked(GtkButton * button, gpointer user_data)
+{
+   int i;
+
+   gtk_widget_hide(gGpioDialog);
+
+   /* set the gpio states to those saved earlier */
+
+   for (i=0; i<PISCOPE_GPIOS; i++)
+   {
+      gtk_toggle_button_set_active(gGpioInfo[i].button, gGpioTempDisplay[i]);
+   }
+}
+
+/* TRGS ------------------------------------------------------------------- */
+
+/* arm the triggers and sequences for the next sample window */
+
+static void trgs_rearm(void)
+{
+   int i;
+
+   gTriggerFired = 0;
+   gTriggerCount = 0;
+   gTriggerPre   = 0;
+
+   for (i=0; i<PISCOPE_TRIGGERS; i++) gTrigInfo[i].fired = 0;
+
+   for (i=0; i<PISCOPE_SEQUENCES; i++) gSequence[i].fired = 0;
+}
+
+static void trgs_reset(void)
+{
+   trgs_rearm();
+
+   gWindows = 0;
+   gWindowShown = -1;
+
+   gLockTick = 0;
+   gLockPending = 0;
+}
+
+static void trgs_lab_str(int trig)
+{
+   int i;
+   char *trigTypeStr= "-01EFRHhLlTG";
+   char buf[PISCOPE_GPIOS+1];
+
+   for (i=0; i<PISCOPE_GPIOS; i++)
+   {
+      buf[i] = trigTypeStr[gTrigInfo[trig].type[i]];
+   }
+
+   buf[PISCOPE_GPIOS] = 0;
+
+   util_labelText(gTrigInfo[trig].labelW, buf);
+}
+
+static void trgs_when_changed(GtkComboBox *widget, int trig)
+{
+   gTrigInfo[trig-1].when = gtk_combo_box_get_active(widget);
+}
+
+void trgs_when1_changed(GtkComboBox *widget, gpointer user_data)
+{
+   trgs_when_changed(widget, 1);
+}
+
+void trgs_when2_changed(GtkComboBox *widget, gpointer user_data)
+{
+   trgs_when_changed(widget, 2);
+}
+
+void trgs_when3_changed(GtkComboBox *widget, gpointer user_data)
+{
+   trgs_when_changed(widget, 3);
+}
+
+void trgs_when4_changed(GtkComboBox *widget, gpointer user_data)
+{
+   trgs_when_changed(widget, 4);
+}
+
+void trgs_samples_changed(GtkComboBox *widget, gpointer user_data)
+{
+   int i;
+
+   i = gtk_combo_box_get_active(widget);
+
+   sscanf(gTrigSamplesText[i], "%d", &gTrigSamples);
+}
+
+void trgs_windows_changed(GtkComboBox *widget, gpointer user_data)
+{
+   int i;
+
+   i = gtk_combo_box_get_active(widget);
+
+   sscanf(gTrigWindowsText[i], "%d", &gTrigWindows);
+}
+
+void trgs_repeat_changed(GtkComboBox *widget, gpointer user_data)
+{
+   gTrigRepeat = gtk_combo_box_get_active(widget);
+
+   gLockTick = 0;
+   gLockPending = 0;
+}
+
+void trgs_holdoff_changed(GtkEditable *editable, gpointer user_data)
+{
+   gTrigHoldoff = atoi(gtk_entry_get_text(GTK_ENTRY(editable)));
+
+   if (gTrigHoldoff < 0) gTrigHoldoff = 0;
+}
+
+static void trgs_on_toggled(GtkToggleButton *button, int trig)
+{
+   int on;
+
+   on = gtk_toggle_button_get_active(button);
+
+   if (gTrigInfo[trig-1].levelMask | gTrigInfo[trig-1].changedMask |
+       gTrigInfo[trig-1].durationMask)
+   {
+      if (on != gTrigInfo[trig-1].enabled)
+      {
+         gTrigInfo[trig-1].enabled = on;
+
+         engine_compile();
+
+         pigpioSetWatchdogs(1);
+
+         hits_rebuild();
+      }
+   }
+   else
+   {
+      if (on)
+      {
+         /* illegal trigger, force off */
+         gtk_toggle_button_set_active(button, 0);
+      }
+   }
+}
+
+void trgs_on1_toggled(GtkToggleButton * button, gpointer user_data)
+{
+   trgs_on_toggled(button, 1);
+}
+
+void trgs_on2_toggled(GtkToggleButton * button, gpointer user_data)
+{
+   trgs_on_toggled(button, 2);
+}
+
+void trgs_on3_toggled(GtkToggleButton * button, gpointer user_data)
+{
+   trgs_on_toggled(button, 3);
+}
+
+void trgs_on4_toggled(GtkToggleButton * button, gpointer user_data)
+{
+   trgs_on_toggled(button, 4);
+}
+
+void trgs_edit1_clicked(GtkButton * button, gpointer user_data)
+{
+   util_trig_activate(1);
+}
+
+void trgs_edit2_clicked(GtkButton * button, gpointer user_data)
+{
+   util_trig_activate(2);
+}
+
+void trgs_edit3_clicked(GtkButton * button, gpointer user_data)
+{
+   util_trig_activate(3);
+}
+
+void trgs_edit4_clicked(GtkButton * button, gpointer user_data)
+{
+   util_trig_activate(4);
+}
+
+void trgs_close_clicked(GtkButton * button, gpointer user_data)
+{
+   int i, j;
+   gtk_widget_hide(gTrgsDialog);
+
+   for(i=0; i< sizeof(gTrigSamplesText)/sizeof(gTrigSamplesText[0]); i++)
+      {
+         sscanf(gTrigSamplesText[i], "%d", &j);
+         if(j == gTrigSamples)
+            {
+               gSettings.triggerSamples = i;
+               break;
+            }
+      }
+
+   gSettings.triggerWindows =
+      gtk_combo_box_get_active(GTK_COMBO_BOX(gTrgsWindows));
+
+   gSettings.triggerRepeat = gTrigRepeat;
+   gSettings.triggerHoldoff = gTrigHoldoff;
+
+   for(i=0; i<PISCOPE_TRIGGERS; i++)
+      {
+         gSettings.triggers[i].enabled = gTrigInfo[i].enabled;
+         gSettings.triggers[i].action = gTrigInfo[i].when;
+         for (j=0; j<PISCOPE_GPIOS; j++)
+            gSettings.triggers[i].gpiotypes[j] = gTrigInfo[i].type[j];
+      }
+   pigpioSaveSettings();
+}
+
+/* TRIG ------------------------------------------------------------------- */
+
+void trig_apply_clicked(GtkButton * button, gpointer user_data)
+{
+   int i, micros;
+
+   if (!gTriggerNum) return;
+
+   for (i=0; i<PISCOPE_GPIOS; i++)
+      {
+         gSettings.triggers[gTriggerNum-1].gpiotypes[i] = gtk_combo_box_get_active(GTK_COMBO_BOX(gTrigCombo[i]));
+      }
+   micros = atoi(gtk_entry_get_text(GTK_ENTRY(gTrigMicros)));
+   if (micros < 0) micros = 0;
+   gSettings.triggers[gTriggerNum-1].micros = micros;
+   util_setTriggerGPIOTypes(gTriggerNum-1);
+
+   trgs_lab_str(gTriggerNum-1);
+
+   if (gTrigInfo[gTriggerNum-1].enabled) hits_rebuild();
+
+   gtk_widget_hide(gTrigDialog);
+
+   gTriggerNum = 0;
+}
+
+void trig_cancel_clicked(GtkButton * button, gpointer user_data)
+{
+   gtk_widget_hide(gTrigDialog);
+
+   gTriggerNum = 0;
+}
+
+/* triggers per second, measured over about a second of wall time */
+
+static void trig_rateShow(void)
+{
+   static gint64 lastTime;
+   static uint64_t lastHits;
+
+   double secs;
+   char buf[32];
+
+   secs = util_everySecond(&lastTime);
+
+   if (secs > 0.0)
+   {
+      sprintf(buf, "%.0f/s", (gTrigHits - lastHits) / secs);
+
+      util_labelText(gMainLrate, buf);
+   }
+
+   if (secs != 0.0) lastHits = gTrigHits;
+}
+
+void trig_countsShow(void)
+{
+   static char symbol[]="#>~<";
+
+   int i;
+   char c[PISCOPE_TRIGGERS];
+   char buf[128];
+   GString *str;
+
+   for (i=0; i<PISCOPE_TRIGGERS; i++)
+   {
+      if (gTrigInfo[i].enabled) c[i] = symbol[gTrigInfo[i].when];
+      else                      c[i] = ' ';
+   }
+
+   sprintf(buf, "1%c%Lu  2%c%Lu  3%c%Lu  4%c%Lu",
+      c[0], (long long)gTrigInfo[0].count,
+      c[1], (long long)gTrigInfo[1].count,
+      c[2], (long long)gTrigInfo[2].count,
+      c[3], (long long)gTrigInfo[3].count);
+
+   util_labelText(gMainLtrigs, buf);
+
+   /* the counters and sequences are listed in the tooltip */
+
+   if (gSettings.counters || gSettings.sequences)
+   {
+      str = g_string_new(NULL);
+
+      for (i=0; i<gSettings.counters; i++)
+      {
+         if (str->len) g_string_append_c(str, '\n');
+
+         g_string_append_printf(str, "%s %llu",
+            gSettings.counter[i].name, (unsigned long long)gCounterCount[i]);
+      }
+
+      for (i=0; i<gSettings.sequences; i++)
+      {
+         if (str->len) g_string_append_c(str, '\n');
+
+         g_string_append_printf(str, "%s %llu",
+            gSettings.sequence[i].name, (unsigned long long)gSequence[i].count);
+      }
+
+      gtk_widget_set_tooltip_text(gMainLtrigs, str->str);
+
+      g_string_free(str, TRUE);
+   }
+}
+
+/* HUD -------------------------------------------------------------------- */
+
+/*
+An overlay on the waveform showing where the time goes.  It is drawn
+over the waveform surface when the window is exposed, so it is never
+part of the waveform itself.  The figures are refreshed once a second.
+*/
+
+static int      gHud;
+static uint64_t gHudReports;  /* reports taken from the capture ring */
+static uint64_t gHudCoarse;   /* frames drawn at reduced detail */
+static uint64_t gHudDrawn;
+static int      gHudRender[PISCOPE_HUD_FRAMES]; /* micros */
+static int      gHudLines;
+static char     gHudText[PISCOPE_HUD_LINES][64];
+
+static void hud_frame(int micros)
+{
+   gHudRender[gHudDrawn % PISCOPE_HUD_FRAMES] = micros;
+
+   gHudDrawn++;
+}
+
+static int hud_cmpInt(const void *a, const void *b)
+{
+   return *(const int *)a - *(const int *)b;
+}
+
+static void hud_update(void)
+{
+   static gint64 lastTime;
+   static uint64_t lastReports, lastCoarse, lastDrawn;
+   static int64_t lastSamples;
+
+   int render[PISCOPE_HUD_FRAMES];
+   int frames, bytes, ring, i;
+   int64_t samples, capacity;
+   double secs, fill, rate;
+
+   if (!gHud)
+   {
+      lastTime = 0;
+      return;
+   }
+
+   if (!(secs = util_everySecond(&lastTime))) return;
+
+   samples = gStore.next;
+
+   if (secs > 0.0)
+   {
+      /* reports waiting in the socket and in the capture ring */
+
+      bytes = 0;
+
+      if (gPigNotify >= 0) ioctl(gPigNotify, FIONREAD, &bytes);
+
+      ring = g_atomic_int_get(&gCapHead) - gCapTail;
+
+      frames = gHudDrawn;
+
+      if (frames > PISCOPE_HUD_FRAMES) frames = PISCOPE_HUD_FRAMES;
+
+      memcpy(render, gHudRender, frames * sizeof(int));
+
+      qsort(render, frames, sizeof(int), hud_cmpInt);
+
+      capacity = store_capacity(&gStore);
+
+      if (capacity < 1) capacity = 1;
+
+      fill = (100.0 * (gStore.next - gStore.first)) / capacity;
+
+      rate = 0.0;
+
+      if (samples >= lastSamples)
+         rate = (100.0 * (samples - lastSamples)) / capacity / secs;
+
+      i = 0;
+
+      sprintf(gHudText[i++], "ingest  %9.0f reports/s %9.0f samples/s",
+         (gHudReports - lastReports) / secs,
+         (samples >= lastSamples) ? (samples - lastSamples) / secs : 0.0);
+
+      sprintf(gHudText[i++], "backlog %9d socket    %9d ring",
+         bytes / (int)sizeof(gpioReport_t), ring);
+
+      sprintf(gHudText[i++], "cycle   %9d reports", gReportsPerCycle);
+
+      if (frames)
+      {
+         sprintf(gHudText[i++], "render  %9.1f ms p50  %9.1f ms p99",
+            render[frames/2] / 1000.0, render[((frames*99)-1)/100] / 1000.0);
+      }
+      else sprintf(gHudText[i++], "render        none");
+
+      sprintf(gHudText[i++], "frames  %9.0f drawn/s %9.0f coarse/s",
+         (gHudDrawn - lastDrawn) / secs, (gHudCoarse - lastCoarse) / secs);
+
+      sprintf(gHudText[i++], "buffer  %9.1f%% full  %9.2f%%/s", fill, rate);
+
+      gHudLines = i;
+   }
+
+   lastReports = gHudReports;
+   lastCoarse  = gHudCoarse;
+   lastDrawn   = gHudDrawn;
+   lastSamples = samples;
+}
+
+static void hud_draw(cairo_t *cr)
+{
+   cairo_text_extents_t te;
+   double width, line;
+   int i;
+
+   if (!gHud) return;
+
+   cairo_select_font_face(cr, "monospace",
+      CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+
+   cairo_set_font_size(cr, 12.0);
+
+   line = 15.0;
+
+   if (!gHudLines)
+   {
+      gHudLines = 1;
+      strcpy(gHudText[0], "measuring...");
+   }
+
+   for (i=0, width=0.0; i<gHudLines; i++)
+   {
+      cairo_text_extents(cr, gHudText[i], &te);
+
+      if (te.x_advance > width) width = te.x_advance;
+   }
+
+   cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.7);
+
+   cairo_rectangle(cr, 8, 8, width + 12, (gHudLines * line) + 8);
+
+   cairo_fill(cr);
+
+   cairo_set_source_rgb(cr, 1.0, 1.0, 0.3);
+
+   for (i=0; i<gHudLines; i++)
+   {
+      cairo_move_to(cr, 14, 8 + ((i+1) * line));
+
+      cairo_show_text(cr, gHudText[i]);
+   }
+}
+
+/* MAIN UTIL -------------------------------------------------------------- */
+
+static void main_util_labelTick(int64_t *tick, GtkWidget *label)
+{
+   int64_t diff;
+   int s, m;
+   char buf[64];
+
+   diff = (*tick) - gTickOrigin;
+
+   s = diff/PISCOPE_MILLION;
+   m = diff%PISCOPE_MILLION;
+
+   sprintf(buf, "%d.%06d ", s, m);
+
+   util_labelText(label, buf);
+}
+
+static void main_util_labelBlueTick(void)
+{
+   int64_t diff1, diff2;
+   int s1, s2, m1, m2, sign;
+   char buf[64];
+
+   main_util_labelTick(&gBlueTick, gMainLblue);
+
+   diff1 = gGoldTick - gTickOrigin;
+
+   s1 = diff1/PISCOPE_MILLION;
+   m1 = diff1%PISCOPE_MILLION;
+
+   diff2 = gBlueTick - gGoldTick;
+
+   sign = '+';
+
+   if (diff2 < 0) {diff2 = -diff2; sign = '-';}
+
+   s2 = diff2/PISCOPE_MILLION;
+   m2 = diff2%PISCOPE_MILLION;
+
+   if (s2) sprintf(buf, "%d.%06d (%c%d.%06d)", s1, m1, sign, s2, m2);
+   else    sprintf(buf, "%d.%06d (%c%d us)", s1, m1, sign, m2);
+
+   util_labelText(gMainLgold, buf);
+}
+
+/* start, or extend, the samples taken once a trigger or sequence fires */
+
+static void main_util_fire(piscopeTrigWhen_t when, int *fired)
+{
+   int samples, pre;
+
+   if ((gMode != piscope_live) || *fired) return;
+
+   samples = 0;
+   pre = 0;
+
+   switch(when)
+   {
+      case piscope_count:
+         break;
+
+      case piscope_sample_from:
+         *fired = 1;
+         samples = gTrigSamples;
+         break;
+
+      case piscope_sample_around:
+         *fired = 1;
+         samples = gTrigSamples/2;
+         pre = gTrigSamples/2;
+         break;
+
+      case piscope_sample_to:
+         *fired = 1;
+         pre = gTrigSamples;
+         break;
+   }
+
+   if (!*fired) return;
+
+   if (!gTriggerFired)
+   {
+      gTriggerFired = 1;
+      gTriggerSample = gStore.next - 1;
+   }
+
+   if (samples > gTriggerCount) gTriggerCount = samples;
+
+   if (pre > gTriggerPre) gTriggerPre = pre;
+}
+
+/* accept a trigger for the repetitive display once the previous
+   frame has been acquired and the holdoff has passed */
+
+static void main_util_lock(int64_t tick)
+{
+   if (gLockPending)
+   {
+      if (tick < (gLockPending + (gViewTicks/2) + gTrigHoldoff)) return;
+
+      gLockTick = gLockPending;
+   }
+
+   gLockPending = tick;
+}
+
+/* record the window just completed, then rearm or pause */
+
+static void main_util_windowEnd(void)
+{
+   piscopeWindow_t *win;
+   char buf[32];
+
+   if (gWindows < PISCOPE_MAX_WINDOWS)
+   {
+      win = &gWindow[gWindows++];
+
+      win->trigger = gTriggerSample;
+      win->start   = gTriggerSample - gTriggerPre;
+      win->end     = gStore.next - 1;
+
+      if (win->start < gStore.first) win->start = gStore.first;
+   }
+
+   if (gWindows < gTrigWindows)
+   {
+      trgs_rearm();
+
+      sprintf(buf, "LIVE %d/%d", gWindows, gTrigWindows);
+      util_labelText(gMainLmode, buf);
+   }
+   else
+   {
+      gMode = piscope_pause;
+
+      gtk_toggle_tool_button_set_active
+         (GTK_TOGGLE_TOOL_BUTTON(gMainTBpause), TRUE);
+   }
+}
+
+/* advance each sequence by one stored sample */
+
+static void main_util_sequences(int64_t tick, uint32_t level, uint64_t matched)
+{
+   piscopeSequence_t *seq;
+   piscopeStage_t *stage;
+   int i;
+
+   for (i=0; i<gSettings.sequences; i++)
+   {
+      seq = &gSequence[i];
+
+      stage = &seq->stage[seq->at];
+
+      if (seq->at || seq->repeats)
+      {
+         if (((level & stage->holdMask) != stage->holdValue) ||
+             (seq->at && stage->within &&
+              ((tick - seq->since) > stage->within)))
+         {
+            /* start again, this sample may begin the first stage */
+
+            seq->at      = 0;
+            seq->repeats = 0;
+
+            stage = &seq->stage[0];
+         }
+      }
+
+      if (matched & stage->entry)
+      {
+         if (++seq->repeats >= stage->repeat)
+         {
+            seq->repeats = 0;
+            seq->since   = tick;
+
+            if (++seq->at >= seq->stages)
+            {
+               seq->at = 0;
+               seq->count++;
+
+               main_util_fire(seq->when, &seq->fired);
+            }
+         }
+      }
+   }
+}
+
+/* count and act on the triggers hit at tick */
+
+static void main_util_triggered(uint32_t triggered, int64_t tick)
+{
+   int i;
+
+   gTrigHits++;
+
+   if ((gTrigRepeat != piscope_single) && (gMode == piscope_live))
+      main_util_lock(tick);
+
+   for (i=0; i<PISCOPE_TRIGGERS; i++)
+   {
+      if (triggered & (1<<i))
+      {
+         gTrigInfo[i].count++;
+
+         main_util_fire(gTrigInfo[i].when, &gTrigInfo[i].fired);
+      }
+   }
+}
+
+/* make the first report the time origin */
+
+static void main_util_firstReport(const gpioReport_t *report)
+{
+   int i;
+
+   gTickOrigin = report->tick;
+
+   gGoldTick = gTickOrigin;
+
+   gettimeofday(&gTimeOrigin, NULL);
+
+   gIngest.high      = 0;
+   gIngest.lastTick  = report->tick;
+   gIngest.lastLevel = report->level;
+   gIngest.prevTick  = report->tick;
+   gIngest.idleTick  = report->tick;
+   gIngest.seq       = report->seqno + 1;
+   gIngest.gap       = 0;
+   gIngest.lost      = 0;
+   gIngest.gaps      = 0;
+   gIngest.watchdogs = 0;
+   gIngest.alives    = 0;
+
+   for (i=0; i<PISCOPE_GPIOS; i++) gIngest.lastEdge[i] = -1;
+
+   store_append(&gStore, report->tick, report->level, 1);
+}
+
+/*
+Store a sample whose level differs from the previous one.  matched holds
+the triggers and counters the sample matched, as worked out by
+engine_matchBatch.
+*/
+
+static void main_util_insertSample(int64_t tick, uint32_t level, uint64_t matched)
+{
+   int triggered, i;
+   uint32_t changed, held, idleHit, idleFired;
+
+   held    = gStore.lastLevel;
+   changed = level ^ held;
+
+   /* keep capturing while paused, a snapshot is being displayed */
+
+   if (store_append(&gStore, tick, level, 1) < 0)
+   {
+      /* out of memory, simply ignore new samples */
+      return;
+   }
+
+   if (gIngest.gap)
+   {
+      store_gapAppend(&gStore, gStore.next - 1);
+
+      gIngest.gap = 0;
+   }
+
+   matched &= ~(uint64_t)gIdleTriggers;
+
+   if (matched & ((1<<PISCOPE_TRIGGERS)-1))
+      matched = engine_durations
+         (matched, tick, gIngest.prevTick, gIngest.lastEdge);
+
+   /* an idle trigger is indexed at the first sample past T, as a rebuild
+      would index it, but not acted on again if a report past T was */
+
+   idleHit   = 0;
+   idleFired = 0;
+
+   if (gIdleTriggers)
+   {
+      idleHit = engine_idle(held, tick, gIngest.prevTick, gIngest.lastEdge);
+
+      if (idleHit)
+      {
+         idleFired = idleHit & engine_idle(held, tick,
+            MAX(gIngest.prevTick, gIngest.idleTick), gIngest.lastEdge);
+      }
+   }
+
+   for (; changed; changed &= (changed-1))
+   {
+      gIngest.lastEdge[__builtin_ctz(changed)] = tick;
+   }
+
+   gIngest.prevTick = tick;
+
+   for (i=0; i<gSettings.counters; i++)
+   {
+      if (matched & (1ULL<<(PISCOPE_TRIGGERS+i))) gCounterCount[i]++;
+   }
+
+   triggered = matched & ((1<<PISCOPE_TRIGGERS)-1);
+
+   if (triggered | idleHit) store_hitAppend(&gStore, gStore.next - 1);
+
+   if ((triggered |= idleFired)) main_util_triggered(triggered, tick);
+
+   if (gSettings.sequences) main_util_sequences(tick, level, matched);
+
+   if ((gMode == piscope_live) && gTriggerFired)
+   {
+      if (--gTriggerCount < 0) main_util_windowEnd();
+   }
+}
+
+/*
+A gpio which goes quiet stores no samples, so an idle trigger whose only
+edge conditions are idle ones is also checked at the tick of the newest
+report, stored or not.  Keep-alive reports and the watchdog reports set
+up by pigpioSetWatchdogs keep those ticks coming on a quiet bus.  The
+trigger acts at once, its hit is indexed at the sample which ends the
+quiet, where hits_rebuild puts it too.  Triggers mixing idle and other
+conditions are left to the stored samples.
+*/
+
+static void main_util_idle(void)
+{
+   uint32_t triggered;
+   int64_t now, prev;
+
+   now  = gIngest.high | gIngest.lastTick;
+   prev = MAX(gIngest.prevTick, gIngest.idleTick);
+
+   if (now <= prev) return;
+
+   gIngest.idleTick = now;
+
+   triggered = engine_idle(gStore.lastLevel, now, prev, gIngest.lastEdge);
+
+   if (triggered) main_util_triggered(triggered, now);
+}
+
+static gboolean main_util_input(gpointer user_data)
+{
+   struct timeval t1, t2, tDiff;
+
+   guint head, tail, pos;
+   int reports, micros, r, b, k, s, batch, samples;
+   int64_t t, tBatch;
+   gpioReport_t *report;
+   int64_t tick[PISCOPE_ENGINE_BATCH];
+   uint32_t level[PISCOPE_ENGINE_BATCH];
+   uint64_t matched[PISCOPE_ENGINE_BATCH];
+
+   if (gInputState == piscope_initialise)
+   {
+      gInputState = piscope_running;
+   }
+   else if (gInputState == piscope_quit)    {gtk_main_quit(); return FALSE;}
+   else if (gInputState == piscope_dormant) return TRUE;
+
+   t = trace_begin();
+
+   gettimeofday(&t1, NULL);
+
+   /* drain whatever the capture thread has published */
+
+   head = g_atomic_int_get(&gCapHead);
+   tail = gCapTail;
+
+   reports = head - tail;
+
+   if (reports > gReportsPerCycle) reports = gReportsPerCycle;
+
+   for (r=0; r<reports; r+=batch)
+   {
+      pos = (tail + r) & (PISCOPE_CAPTURE_REPORTS - 1);
+
+      batch = reports - r;
+
+      if (batch > PISCOPE_ENGINE_BATCH) batch = PISCOPE_ENGINE_BATCH;
+
+      /* the kernels want the reports contiguous */
+
+      if (batch > (PISCOPE_CAPTURE_REPORTS - pos))
+         batch = PISCOPE_CAPTURE_REPORTS - pos;
+
+      report = &gCapRing[pos];
+      b = batch;
+
+      tBatch = trace_begin();
+
+      if (gStore.next == 0)
+      {
+         main_util_firstReport(report);
+
+         report++;
+         b--;
+      }
+
+      while (b > 0)
+      {
+         /* runs are split where pigpiod lost reports */
+
+         k = ingest_gap(report, b, &gIngest);
+
+         /* reduce the run to level changes, then match them against
+            every trigger and counter */
+
+         samples = gKernel(report, k, &gIngest, tick, level);
+
+         engine_matchBatch(level, gStore.lastLevel, samples, matched);
+
+         for (s=0; s<samples; s++)
+            main_util_insertSample(tick[s], level[s], matched[s]);
+
+         report += k;
+         b -= k;
+      }
+
+      trace_end(&gTraceUI, "ingest", tBatch, batch);
+   }
+
+   g_atomic_int_set(&gCapTail, tail + reports);
+
+   if (gStore.next) main_util_idle();
+
+   gHudReports += reports;
+
+   trace_end(&gTraceUI, "input", t, reports);
+
+   gettimeofday(&t2, NULL);
+
+   timersub(&t2, &t1, &tDiff);
+
+   micros = (tDiff.tv_sec * PISCOPE_MILLION) + tDiff.tv_usec;
+
+   /* counted against the budget of the next frame */
+
+   gFrameInput += micros;
+
+   if (reports >= 500)
+   {
+      if (micros < 1) micros = 1;
+
+      r = ((int64_t)gTimeSlotMicros*reports)/micros;
+
+      r = (80 * r) / 100;  /* give some spare time in  slot */
+
+      if (r > gReportsPerCycle)
+      {
+         gReportsPerCycle = r;
+      }
+   }
+
+   return TRUE;
+}
+
+static int64_t main_util_blockLastTick(int64_t block)
+{
+   piscopeSegment_t *seg;
+   int offset;
+
+   seg = store_seg(gView, block << PISCOPE_BLOCK_SHIFT);
+
+   offset = (block << PISCOPE_BLOCK_SHIFT) & (PISCOPE_SEG_SAMPLES-1);
+
+   return store_segLastTick(seg, offset, PISCOPE_BLOCK_SAMPLES);
+}
+
+/*
+Return the first sample in s1..s2 at or after tick, or s2.  The block
+is found first from the block tick directory so only one block of a
+packed segment needs to be unpacked.
+*/
+
+static int64_t main_util_bsearch(int64_t s1, int64_t s2, int64_t *tick)
+{
+   int64_t mid, b1, b2;
+
+   b1 = s1 >> PISCOPE_BLOCK_SHIFT;
+   b2 = s2 >> PISCOPE_BLOCK_SHIFT;
+
+   while (b1 < b2)
+   {
+      mid = b1 + (b2 - b1) / 2;
+
+      if (main_util_blockLastTick(mid) < (*tick)) b1 = mid + 1;
+      else                                        b2 = mid;
+   }
+
+   if ((b1 << PISCOPE_BLOCK_SHIFT) > s1) s1 = b1 << PISCOPE_BLOCK_SHIFT;
+
+   b2 = ((b1 + 1) << PISCOPE_BLOCK_SHIFT) - 1;
+
+   if (b2 < s2) s2 = b2;
+
+   while (s1 < s2)
+   {
+      mid = s1 + (s2 - s1) / 2;
+
+      if (store_tick(gView, mid) < (*tick)) s1 = mid + 1;
+      else                                    s2 = mid;
+   }
+
+   return s1;
+}
+
+/*
+Move the blue marker to the next or previous edge of the highlighted
+gpios, or of any gpio if none are highlighted, using the edge index.
+*/
+
+static void main_util_searchEdge(int dir)
+{
+   uint32_t mask;
+   int64_t s, last, tick;
+
+   if (gHilitGpios) mask = gHilitGpios; else mask = -1;
+
+   if (gBlueTick && (gView->next > gView->first))
+   {
+      last = gView->next - 1;
+
+      if (dir)
+      {
+         /* the last sample at or before the marker */
+
+         tick = gBlueTick + 1;
+
+         s = main_util_bsearch(gView->first, last, &tick);
+
+         if (store_tick(gView, s) > gBlueTick) s--;
+
+         s = store_nextEdge(gView, s, last, mask);
+
+         if (s >= 0)
+         {
+            gBlueTick = store_tick(gView, s);
+
+            if (gBlueTick > gViewEndTick)
+               gViewCentreTick = gBlueTick + (0.4 * gViewTicks);
+         }
+      }
+      else
+      {
+         /* the last sample before the marker */
+
+         tick = gBlueTick;
+
+         s = main_util_bsearch(gView->first, last, &tick);
+
+         if (store_tick(gView, s) >= gBlueTick) s--;
+
+         if (s > gView->first) s = store_prevEdge(gView, s, mask);
+         else                  s = -1;
+
+         if (s >= 0)
+         {
+            gBlueTick = store_tick(gView, s);
+
+            if (gBlueTick < gViewStartTick)
+               gViewCentreTick = gBlueTick - (0.4 * gViewTicks);
+         }
+      }
+
+      main_util_labelBlueTick();
+
+   }
+}
+
+/* move the blue marker to the next or previous trigger hit */
+
+static void main_util_searchTrigger(int dir)
+{
+   int64_t s, last, tick;
+
+   if (gBlueTick && (gView->next > gView->first))
+   {
+      last = gView->next - 1;
+
+      if (dir)
+      {
+         tick = gBlueTick + 1;
+
+         s = main_util_bsearch(gView->first, last, &tick);
+
+         if (store_tick(gView, s) > gBlueTick) s--;
+
+         s = store_nextHit(gView, s, last);
+
+         if (s >= 0)
+         {
+            gBlueTick = store_tick(gView, s);
+
+            if (gBlueTick > gViewEndTick)
+               gViewCentreTick = gBlueTick + (0.4 * gViewTicks);
+         }
+      }
+      else
+      {
+         tick = gBlueTick;
+
+         s = main_util_bsearch(gView->first, last, &tick);
+
+         if (store_tick(gView, s) >= gBlueTick) s--;
+
+         if (s > gView->first) s = store_prevHit(gView, s);
+         else                  s = -1;
+
+         if (s >= 0)
+         {
+            gBlueTick = store_tick(gView, s);
+
+            if (gBlueTick < gViewStartTick)
+               gViewCentreTick = gBlueTick - (0.4 * gViewTicks);
+         }
+      }
+
+      main_util_labelBlueTick();
+
+   }
+}
+
+/* centre the view on the next or previous captured trigger window */
+
+static void main_util_searchWindow(int dir)
+{
+   piscopeWindow_t *win;
+   char buf[32];
+   int w;
+
+   w = gWindowShown;
+
+   while (1)
+   {
+      if (dir) w++; else w--;
+
+      if ((w < 0) || (w >= gWindows)) return;
+
+      /* skip windows since overwritten by newer samples */
+
+      if (gWindow[w].start >= gView->first) break;
+   }
+
+   gWindowShown = w;
+
+   win = &gWindow[w];
+
+   gBlueTick = store_tick(gView, win->trigger);
+
+   gViewCentreTick =
+      (store_tick(gView, win->start) + store_tick(gView, win->end)) / 2;
+
+   main_util_labelBlueTick();
+
+   sprintf(buf, "PAUSE %d/%d", w+1, gWindows);
+   util_labelText(gMainLmode, buf);
+}
+
+/* shade the time between samples where pigpiod lost reports */
+
+static void main_util_gaps(void)
+{
+   int64_t n, x1, x2;
+
+   cairo_set_source_rgba(gCoscCairo, 1.0, 0.0, 0.0, 0.4);
+
+   n = gViewStartSample;
+
+   while ((n = store_nextGap(gView, n, gViewEndSample)) >= 0)
+   {
+      x1 = (int64_t)10 * (store_tick(gView, n-1) - gViewStartTick) /
+         (int64_t)gDeciMicroPerPix;
+
+      x2 = (int64_t)10 * (store_tick(gView, n) - gViewStartTick) /
+         (int64_t)gDeciMicroPerPix;
+
+      if (x1 < 0) x1 = 0;
+      if (x2 > gCoscWidth) x2 = gCoscWidth;
+      if (x2 <= x1) x2 = x1 + 1;
+
+      cairo_rectangle(gCoscCairo, x1, 0, x2 - x1, gCoscHeight);
+   }
+
+   cairo_fill(gCoscCairo);
+}
+
+static void main_util_1Tick(void)
+{
+   int64_t x, diffTick;
+
+   if ((g1Tick > gViewStartTick) && (g1Tick < gViewEndTick))
+   {
+      cairo_set_line_width(gCoscCairo, 1.0);
+
+      cairo_set_source_rgb(gCoscCairo, 0.3, 1.0, 0.3);
+
+      diffTick = g1Tick - gViewStartTick;
+
+      x = (int64_t)10 * diffTick / (int64_t)gDeciMicroPerPix;
+
+      cairo_move_to(gCoscCairo, x, 0);
+
+      cairo_line_to(gCoscCairo, x, gCoscHeight);
+
+      cairo_stroke(gCoscCairo);
+   }
+}
+
+
+static void main_util_2Tick(void)
+{
+   int64_t x, diffTick;
+
+   if ((g2Tick > gViewStartTick) && (g2Tick < gViewEndTick))
+   {
+      cairo_set_line_width(gCoscCairo, 1.0);
+
+      cairo_set_source_rgb(gCoscCairo, 1.0, 0.3, 0.3);
+
+      diffTick = g2Tick - gViewStartTick;
+
+      x = (int64_t)10 * diffTick / (int64_t)gDeciMicroPerPix;
+
+      cairo_move_to(gCoscCairo, x, 0);
+
+      cairo_line_to(gCoscCairo, x, gCoscHeight);
+
+      cairo_stroke(gCoscCairo);
+   }
+}
+
+
+static void main_util_GoldTick(void)
+{
+   int64_t x, diffTick;
+
+   if ((gGoldTick > gViewStartTick) && (gGoldTick < gViewEndTick))
+   {
+      cairo_set_line_width(gCoscCairo, 1.0);
+
+      cairo_set_source_rgb(gCoscCairo, 1.0, 1.0, 0.3);
+
+      diffTick = gGoldTick - gViewStartTick;
+
+      x = (int64_t)10 * diffTick / (int64_t)gDeciMicroPerPix;
+
+      cairo_move_to(gCoscCairo, x, 0);
+
+      cairo_line_to(gCoscCairo, x, gCoscHeight);
+
+      cairo_stroke(gCoscCairo);
+   }
 }
 
-/* MAIN UTIL -------------------------------------------------------------- */
 
-static void main_util_labelTick(int64_t *tick, GtkWidget *label)
+static void main_util_BlueTick(void)
 {
-   int64_t diff;
-   int s, m;
-   char buf[64];
+   int64_t x, diffTick;
 
-   diff = (*tick) - gTickOrigin;
+   if ((gBlueTick > gViewStartTick) && (gBlueTick < gViewEndTick))
+   {
+      cairo_set_line_width(gCoscCairo, 1.0);
 
-   s = diff/PISCOPE_MILLION;
-   m = diff%PISCOPE_MILLION;
+      cairo_set_source_rgb(gCoscCairo, 0.3, 1.0, 1.0);
 
-   sprintf(buf, "%d.%06d ", s, m);
+      diffTick = gBlueTick - gViewStartTick;
 
-   util_labelText(label, buf);
-}
+      x = (int64_t)(10 * diffTick) / (int64_t)gDeciMicroPerPix;
 
-static void main_util_labelBlueTick(void)
-{
-   int64_t diff1, diff2;
-   int s1, s2, m1, m2, sign;
-   char buf[64];
+      cairo_move_to(gCoscCairo, x, 0);
 
-   main_util_labelTick(&gBlueTick, gMainLblue);
+      cairo_line_to(gCoscCairo, x, gCoscHeight);
 
-   diff1 = gGoldTick - gTickOrigin;
+      cairo_stroke(gCoscCairo);
+   }
+}
 
-   s1 = diff1/PISCOPE_MILLION;
-   m1 = diff1%PISCOPE_MILLION;
+/* the last sample before column x */
 
-   diff2 = gBlueTick - gGoldTick;
+static int64_t main_util_columnSample(int x)
+{
+   int64_t s, tick;
 
-   sign = '+';
+   if (!x) return gViewStartSample;
 
-   if (diff2 < 0) {diff2 = -diff2; sign = '-';}
+   tick = gViewStartTick + (((int64_t)x * gDeciMicroPerPix) + 9) / 10;
 
-   s2 = diff2/PISCOPE_MILLION;
-   m2 = diff2%PISCOPE_MILLION;
+   s = main_util_bsearch(gViewStartSample, gViewEndSample, &tick);
 
-   if (s2) sprintf(buf, "%d.%06d (%c%d.%06d)", s1, m1, sign, s2, m2);
-   else    sprintf(buf, "%d.%06d (%c%d us)", s1, m1, sign, m2);
+   if ((s > gViewStartSample) && (store_tick(gView, s) >= tick)) s--;
 
-   util_labelText(gMainLgold, buf);
+   return s;
 }
 
-static int main_util_checkTriggers(uint32_t new, uint32_t old)
+/*
+Draw a tile of the waveforms while paused.  It has columns of its own,
+so that the tiles missing from a view may be drawn at the same time.
+*/
+
+static void main_util_tileDraw(piscopeTile_t *tile)
 {
-   int i, matched;
-   uint32_t changed;
+   piscopeRaster_t r;
+   int64_t first, last, s, tick;
+   uint32_t level;
+   uint32_t colEdges[PISCOPE_TILE_PIX + 2], colLevel[PISCOPE_TILE_PIX + 2];
 
-   changed = new ^ old;
-   matched = 0;
+   first = gView->first;
+   last  = gView->next - 1;
 
-   for (i=0; i<PISCOPE_TRIGGERS; i++)
-   {
-      if (gTrigInfo[i].enabled)
-      {
-         if (((new&gTrigInfo[i].levelMask) == gTrigInfo[i].levelValue) &&
-             ((gTrigInfo[i].changedMask&changed) == gTrigInfo[i].changedMask))
-         {
-            matched |= (1<<i);
-         }
-      }
-   }
+   /* column 0 is the pixel before the tile */
 
-   return matched;
+   tick = ((tile->index * PISCOPE_TILE_PIX) - 1) * (gDeciMicroPerPix / 10);
 
-}
+   s = main_util_bsearch(first, last, &tick);
 
-static void main_util_insertReport(gpioReport_t * report)
-{
-   static uint32_t lastLevel, lastTick;
-   static uint16_t wrapCount;
+   if ((s > first) && (store_tick(gView, s) >= tick)) s--;
 
-   int triggered, i, samples;
+   level = pyr_scanColumns(gView, s, last, tick, gDeciMicroPerPix,
+      0, PISCOPE_TILE_PIX + 2, 0, colEdges, colLevel);
 
-   if (gBufWritePos < 0) /* first report */
-   {
-      gBufWritePos =  0;
-      gBufReadPos  =  0;
-      gBufSamples  =  1;
+   r.pix    = tile->pix;
+   r.stride = PISCOPE_TILE_PIX + 2;
+   r.x0     = 1;
+   r.x1     = PISCOPE_TILE_PIX + 1;
+   r.edges  = colEdges;
+   r.level  = colLevel;
+
+   raster_lanes(&r, level, 0, PISCOPE_TILE_PIX + 2);
+}
 
-      /* make first report the time origin */
+/*
+Wide strips are split into tiles for a pool of render workers.  First
+each tile's columns are scanned, then each tile's pixels are filled from
+its columns and the one either side.  The UI thread waits out both
+passes, so the store and the column arrays hold still and no two
+workers write the same column or pixel.  The pause mode tiles missing
+from a view are drawn by the same workers as a pass of their own.
+*/
 
-      gTickOrigin = report->tick;
+static GThreadPool     *gRenderPool;
+static GMutex           gRenderMutex;
+static GCond            gRenderCond;
+static int              gRenderPending;
+static int              gRenderPass;
+static piscopeRaster_t  gRenderRaster;
+static int              gRenderC0;
+static int              gRenderC1;
+static uint32_t         gRenderLevel;
 
-      gGoldTick = gTickOrigin;
+static void main_util_renderJob(gpointer data, gpointer user_data)
+{
+   piscopeRenderJob_t *job;
+   piscopeRaster_t r;
+   uint32_t level;
+   int e0, e1;
 
-      gettimeofday(&gTimeOrigin, NULL);
+   job = data;
 
-      wrapCount = 0;
+   /* a freed block may come back at the same address */
 
-      lastTick  = report->tick;
-      lastLevel = report->level;
+   gUnpacked.packed = NULL;
 
-      gSampleTick[0]  = lastTick;
-      gSampleLevel[0] = lastLevel;
+   if (gRenderPass == 0)
+   {
+      job->level = pyr_scanColumns(gView, main_util_columnSample(job->x0),
+         gViewEndSample, gViewStartTick, gDeciMicroPerPix,
+         job->x0, job->x1, gWaveMinLevel, gColEdges, gColLevel);
    }
-   else
+   else if (gRenderPass == 1)
    {
-      if ( (lastTick > 0xF0000000) && ((report->tick) < 0x10000000) )
-      {
-         wrapCount++;
-      }
+      e0 = job->x0 - 1;
+      e1 = job->x1 + 1;
 
-      lastTick  = report->tick;
+      if (e0 < gRenderC0) e0 = gRenderC0;
+      if (e1 > gRenderC1) e1 = gRenderC1;
 
-   }
+      if (e0 == gRenderC0) level = gRenderLevel;
+      else                 level = gColLevel[e0-1];
 
-   if (report->level != lastLevel)
-   {
-      if (++gBufSamples > PISCOPE_SAMPLES)
-      {
-         /* buffer full */
+      r    = gRenderRaster;
+      r.x0 = job->x0;
+      r.x1 = job->x1;
 
-         gBufSamples = PISCOPE_SAMPLES;
+      raster_lanes(&r, level, e0, e1);
+   }
+   else main_util_tileDraw(job->tile);
 
-         if (gMode == piscope_live)
-         {
-            if (++gBufReadPos >= PISCOPE_SAMPLES) gBufReadPos = 0;
-         }
-         else
-         {
-            /* simply ignore new samples */
-            return;
-         }
-      }
+   g_mutex_lock(&gRenderMutex);
 
-      if ((triggered = main_util_checkTriggers(report->level, lastLevel)))
-      {
-         for (i=0; i<PISCOPE_TRIGGERS; i++)
-         {
-            if (triggered & (1<<i))
-            {
-               gTrigInfo[i].count++;
+   if (--gRenderPending == 0) g_cond_signal(&gRenderCond);
 
-               if (gMode == piscope_live)
-               {
-                  if (!gTrigInfo[i].fired)
-                  {
-                     samples = 0;
+   g_mutex_unlock(&gRenderMutex);
+}
 
-                     switch(gTrigInfo[i].when)
-                     {
-                        case piscope_count:
-                           break;
-
-                        case piscope_sample_from:
-                           gTriggerFired = 1;
-                           gTrigInfo[i].fired = 1;
-                           samples = gTrigSamples;
-                           break;
-
-                        case piscope_sample_around:
-                           gTriggerFired = 1;
-                           gTrigInfo[i].fired = 1;
-                           samples = gTrigSamples/2;
-                           break;
-
-                        case piscope_sample_to:
-                           gTriggerFired = 1;
-                           gTrigInfo[i].fired = 1;
-                           break;
-                     }
+static void main_util_renderRun
+   (piscopeRenderJob_t *jobs, int numJobs, int pass)
+{
+   int j;
 
-                     if (samples > gTriggerCount) gTriggerCount = samples;
-                  }
-               }
-            }
-         }
-      }
+   if (!gRenderPool)
+   {
+      gRenderPool = g_thread_pool_new
+         (main_util_renderJob, NULL, gRenderThreads, FALSE, NULL);
+   }
 
-      lastLevel  = report->level;
+   gRenderPass    = pass;
+   gRenderPending = numJobs;
 
-      if (++gBufWritePos >= PISCOPE_SAMPLES) gBufWritePos = 0;
+   for (j=0; j<numJobs; j++) g_thread_pool_push(gRenderPool, &jobs[j], NULL);
 
-      gSampleTick[gBufWritePos]  = ((uint64_t)wrapCount<<32)|lastTick;
-      gSampleLevel[gBufWritePos] = lastLevel;
+   g_mutex_lock(&gRenderMutex);
 
-      if ((gMode == piscope_live) && gTriggerFired)
-      {
-         if (--gTriggerCount < 0)
-         {
-            gMode = piscope_pause;
+   while (gRenderPending) g_cond_wait(&gRenderCond, &gRenderMutex);
 
-            gtk_toggle_tool_button_set_active
-               (GTK_TOGGLE_TOOL_BUTTON(gMainTBpause), TRUE);
-         }
-      }
-   }
+   g_mutex_unlock(&gRenderMutex);
 }
 
-static gboolean main_util_input(gpointer user_data)
+static void main_util_renderPass
+   (piscopeRenderJob_t *jobs, int numJobs, int pass, int x0, int x1)
 {
-   static int reportsPerCycle = 2000;
-   static int got = 0;
-
-   struct timeval tv = { 0L, 0L };
-   struct timeval t1, t2, tDiff;
+   int j;
 
-   int reports, bytes, micros, r;
-
-   fd_set fds;
-
-   if (gInputState == piscope_initialise)
+   for (j=0; j<numJobs; j++)
    {
-      got = 0;
-      gInputState = piscope_running;
+      jobs[j].x0 = x0 + ((x1 - x0) * j) / numJobs;
+      jobs[j].x1 = x0 + ((x1 - x0) * (j+1)) / numJobs;
    }
-   else if (gInputState == piscope_quit)    {gtk_main_quit(); return FALSE;}
-   else if (gInputState == piscope_dormant) return TRUE;
 
-   gettimeofday(&t1, NULL);
+   main_util_renderRun(jobs, numJobs, pass);
+}
 
-   reports = 0;
+static void main_util_renderTiles(int p0, int p1, int c0, int c1)
+{
+   piscopeRenderJob_t jobs[PISCOPE_RENDER_JOBS];
+   int numJobs;
 
-   while (reports <= reportsPerCycle)
-   {
+   numJobs = (p1 - p0) / PISCOPE_RENDER_TILE;
 
-      FD_ZERO(&fds);
+   if (numJobs > PISCOPE_RENDER_JOBS) numJobs = PISCOPE_RENDER_JOBS;
 
-      if (gPigNotify >= 0) FD_SET(gPigNotify, &fds);
+   raster_surface(&gRenderRaster);
 
-      if (select(gPigNotify+1, &fds, NULL, NULL, &tv) != 1) break;
+   gRenderC0 = c0;
+   gRenderC1 = c1;
 
-      bytes = read(gPigNotify, (char*)&gReport+got, sizeof(gReport)-got);
+   main_util_renderPass(jobs, numJobs, 0, c0, c1);
 
-      if (bytes > 0)
-      {
-         got += bytes;
-      }
-      else
-      {
-         break;
-      }
+   gRenderLevel = jobs[0].level;
 
-      r = 0;
+   main_util_renderPass(jobs, numJobs, 1, p0, p1);
 
-      while (got >= sizeof(gpioReport_t))
-      {
-         main_util_insertReport(&gReport[r]);
+   cairo_surface_mark_dirty_rectangle(gWaveSurface, p0, 0, p1-p0, gCoscHeight);
+}
 
-         r++;
+/*
+Draw the waveforms of pixels p0 to p1-1 of the wave surface.  A riser
+in column x covers pixels x-1 and x, so the columns either side of the
+strip are scanned too and the drawing is clipped to the strip.
+*/
 
-         reports++;
+static void main_util_strip(int p0, int p1)
+{
+   int g, x, c0, c1;
+   uint32_t bit, level;
+   piscopeRaster_t r;
 
-         got -= sizeof(gpioReport_t);
-      }
+   double y, yOther;
 
-      /* copy any partial report to start of array */
+   c0 = p0 - 1;
+   c1 = p1 + 1;
 
-      if (got && r) gReport[0] = gReport[r];
-   }
+   if (c0 < 0) c0 = 0;
+   if (c1 > gCoscWidth) c1 = gCoscWidth;
 
-   if (reports >= 500)
+   if (!gRasterCairo && (gRenderThreads > 1) &&
+       ((p1 - p0) >= (2 * PISCOPE_RENDER_TILE)))
    {
-      gettimeofday(&t2, NULL);
+      main_util_renderTiles(p0, p1, c0, c1);
 
-      timersub(&t2, &t1, &tDiff);
+      return;
+   }
 
-      micros = (tDiff.tv_sec * PISCOPE_MILLION) + tDiff.tv_usec;
+   level = pyr_scanColumns(gView, main_util_columnSample(c0),
+      gViewEndSample, gViewStartTick, gDeciMicroPerPix, c0, c1, gWaveMinLevel,
+      gColEdges, gColLevel);
 
-      r = (gTimeSlotMicros*reports)/micros;
+   if (!gRasterCairo)
+   {
+      raster_surface(&r);
 
-      r = (80 * r) / 100;  /* give some spare time in  slot */
+      r.x0 = p0;
+      r.x1 = p1;
 
-      if (r > reportsPerCycle)
-      {
-         reportsPerCycle = r;
-      }
+      raster_lanes(&r, level, c0, c1);
+
+      cairo_surface_mark_dirty_rectangle
+         (gWaveSurface, p0, 0, p1-p0, gCoscHeight);
+
+      return;
    }
 
-   return TRUE;
-}
+   cairo_save(gWaveCairo);
 
-static void main_util_searchEdge(int dir)
-{
-   uint32_t mask, oldLevel, newLevel;
-   int found, first, s;
+   cairo_rectangle(gWaveCairo, p0, 0, p1 - p0, gCoscHeight);
 
-   if (gHilitGpios) mask = gHilitGpios; else mask = -1;
+   cairo_clip(gWaveCairo);
+
+   cairo_set_source_rgb(gWaveCairo, 0.0, 0.0, 0.0);
 
-   if (gBlueTick)
+   cairo_paint(gWaveCairo);
+
+   for (g=0; g<PISCOPE_GPIOS; g++)
    {
-      if (dir)
+      if (gGpioInfo[g].display)
       {
-         s = gViewStartSample;
+         bit = (1<<g);
 
-         found = 0;
+         cairo_set_line_width(gWaveCairo, 0.5);
 
-         oldLevel = gSampleLevel[s] & mask;
+         cairo_set_source_rgb(gWaveCairo, 1.0, 1.0, 1.0);
 
-         while (!found && (s != gBufWritePos))
-         {
-            if (gSampleTick[s] <= gBlueTick)
-            {
-               oldLevel = gSampleLevel[s] & mask;
-            }
-            else
-            {
-               newLevel = gSampleLevel[s] & mask;
+         cairo_move_to(gWaveCairo, 0, gGpioInfo[g].y_tick);
 
-               if (newLevel != oldLevel)
-               {
-                  found = 1;
+         cairo_line_to(gWaveCairo, gCoscWidth, gGpioInfo[g].y_tick);
 
-                  gBlueTick = gSampleTick[s];
+         cairo_stroke(gWaveCairo);
 
-                  if (gBlueTick > gViewEndTick)
-                     gViewCentreTick = gBlueTick + (0.4 * gViewTicks);
-               }
-            }
-            if (++s >= PISCOPE_SAMPLES) s -= PISCOPE_SAMPLES;
-         }
-      }
-      else
-      {
-         s = gViewEndSample;
+         cairo_set_line_width(gWaveCairo, 2.0);
 
-         found = 0;
-         first = 1;
+         cairo_set_source_rgb(gWaveCairo, 0.2, 0.6, 0.1);
 
-         oldLevel = gSampleLevel[s] & mask;
+         if (level & bit) y = gGpioInfo[g].y_high;
+         else             y = gGpioInfo[g].y_low;
 
-         while (!found && (s != gBufReadPos))
+         cairo_move_to(gWaveCairo, c0, y);
+
+         for (x=c0; x<c1; x++)
          {
-            if (gSampleTick[s] < gBlueTick)
+            if (gColEdges[x] & bit)
             {
-               if (first)
-               {
-                  first = 0;
-                  oldLevel = gSampleLevel[s] & mask;
-               }
-               else
-               {
-                  newLevel = gSampleLevel[s] & mask;
+               /* one or more edges in this column, draw a full riser */
 
-                  if (newLevel != oldLevel)
-                  {
-                     found = 1;
+               if (y == gGpioInfo[g].y_high) yOther = gGpioInfo[g].y_low;
+               else                          yOther = gGpioInfo[g].y_high;
 
-                     if (s < PISCOPE_SAMPLES)
-                        gBlueTick = gSampleTick[s+1];
-                     else gBlueTick = gSampleTick[0];
+               cairo_line_to(gWaveCairo, x, y);
+               cairo_line_to(gWaveCairo, x, yOther);
 
-                     if (gBlueTick < gViewStartTick)
-                        gViewCentreTick = gBlueTick - (0.4 * gViewTicks);
-                  }
-               }
+               if (gColLevel[x] & bit) y = gGpioInfo[g].y_high;
+               else                    y = gGpioInfo[g].y_low;
+
+               if (y != yOther) cairo_line_to(gWaveCairo, x, y);
             }
-            if (--s < 0) s += PISCOPE_SAMPLES;
          }
-      }
 
-      main_util_labelBlueTick();
+         /* finish line at strip edge */
 
+         cairo_line_to(gWaveCairo, c1, y);
+
+         cairo_stroke(gWaveCairo);
+      }
    }
+
+   cairo_restore(gWaveCairo);
 }
 
-static void main_util_searchTrigger(int dir)
-{
-   uint32_t old, new;
-   int found, s;
+/*
+While paused the waveforms are kept as tiles on a grid of whole pixels
+from tick 0, so that a view which has been seen before is copied from
+them rather than scanned again.  A tile holds the pixel either side of
+it so that the lanes are drawn the same as across a full view.  The
+tiles of other zoom levels and gpio sets are kept until least recently
+used, those of an earlier generation of the samples or the layout are
+never used.
+*/
 
-   if (gBlueTick)
-   {
-      if (dir)
-      {
-         s = gViewStartSample;
-         old = gSampleLevel[s];
+static piscopeTile_t gTile[PISCOPE_TILES];
+static uint64_t      gTileUsed;
 
-         found = 0;
+/* the cached tile, or the least recently used one claimed for drawing */
 
-         while (!found && (s != gBufWritePos))
-         {
-            new = gSampleLevel[s];
+static piscopeTile_t *main_util_tile(int64_t index, uint32_t gpios, int *miss)
+{
+   piscopeTile_t *tile, *oldest;
+   int i;
 
-            if (gSampleTick[s] > gBlueTick)
-            {
-               found = main_util_checkTriggers(new, old);
+   oldest = &gTile[0];
 
-               if (found)
-               {
-                  gBlueTick = gSampleTick[s];
+   for (i=0; i<PISCOPE_TILES; i++)
+   {
+      tile = &gTile[i];
 
-                  if (gBlueTick > gViewEndTick)
-                     gViewCentreTick = gBlueTick + (0.4 * gViewTicks);
-               }
-            }
-            old = new;
-            if (++s >= PISCOPE_SAMPLES) s -= PISCOPE_SAMPLES;
-         }
-      }
-      else
+      if (tile->pix && (tile->gen == gTileGen) && (tile->index == index) &&
+          (tile->deciMicroPerPix == gDeciMicroPerPix) &&
+          (tile->gpios == gpios) && (tile->height == gCoscHeight))
       {
-         s = gViewEndSample;
-         new = gSampleLevel[s];
-
-         found = 0;
+         tile->used = ++gTileUsed;
 
-         while (!found && (s != gBufReadPos))
-         {
-            old = gSampleLevel[s];
-
-            if (gSampleTick[s] < gBlueTick)
-            {
-               found = main_util_checkTriggers(new, old);
-
-               if (found)
-               {
-                  if ((gBlueTick != gSampleTick[s+1]) &&
-                      (gSampleTick[s+1] < gBlueTick))
-                  {
-                     gBlueTick = gSampleTick[s+1];
-
-                     if (gBlueTick < gViewStartTick)
-                        gViewCentreTick = gBlueTick - (0.4 * gViewTicks);
-                  }
-                  else found = 0;
-               }
-            }
-
-            new = old;
+         *miss = 0;
 
-            if (--s < 0) s += PISCOPE_SAMPLES;
-         }
+         return tile;
       }
 
-      main_util_labelBlueTick();
-
+      if (tile->used < oldest->used) oldest = tile;
    }
-}
 
-static int main_util_bsearch(int s1, int s2, int64_t *tick)
-{
-   int mid, mida;
-
-   if (s2 < s1) s2 += PISCOPE_SAMPLES;
+   tile = oldest;
 
-   while (s1 < s2)
+   if (tile->height != gCoscHeight)
    {
-      mid = s1 + (s2 - s1) / 2;
-
-      mida = mid;
-
-      if (mid >= PISCOPE_SAMPLES) mida -= PISCOPE_SAMPLES;
-
-      if (gSampleTick[mida] < (*tick)) s1 = mid + 1;
-      else                             s2 = mid;
+      tile->pix = g_realloc(tile->pix,
+         (PISCOPE_TILE_PIX + 2) * gCoscHeight * sizeof(uint32_t));
    }
 
-   if (s1 >= PISCOPE_SAMPLES) s1 -= PISCOPE_SAMPLES;
+   tile->index           = index;
+   tile->deciMicroPerPix = gDeciMicroPerPix;
+   tile->gpios           = gpios;
+   tile->height          = gCoscHeight;
+   tile->gen             = gTileGen;
+   tile->used            = ++gTileUsed;
 
-   return s1;
+   *miss = 1;
+
+   return tile;
 }
 
+/* true if the view is on the tile grid */
 
-static void main_util_1Tick(void)
+static int main_util_tiled(void)
 {
-   int64_t x, diffTick;
+   static int64_t first, next;
+   static piscopeStore_t *view;
 
-   if ((g1Tick > gViewStartTick) && (g1Tick < gViewEndTick))
+   if ((gView != view) || (gView->first != first) || (gView->next != next))
    {
-      cairo_set_line_width(gCoscCairo, 1.0);
-
-      cairo_set_source_rgb(gCoscCairo, 0.3, 1.0, 0.3);
-
-      diffTick = g1Tick - gViewStartTick;
-
-      x = (int64_t)10 * diffTick / (int64_t)gDeciMicroPerPix;
+      view  = gView;
+      first = gView->first;
+      next  = gView->next;
 
-      cairo_move_to(gCoscCairo, x, 0);
+      gTileGen++;
+   }
 
-      cairo_line_to(gCoscCairo, x, gCoscHeight);
+   /* every tile of a view is held at once */
 
-      cairo_stroke(gCoscCairo);
-   }
+   return ((gMode == piscope_pause) && !gRasterCairo && !gWaveMinLevel &&
+           (gCoscWidth <= ((PISCOPE_TILES - 1) * PISCOPE_TILE_PIX)) &&
+           ((gDeciMicroPerPix % 10) == 0) && (gViewStartTick >= 0) &&
+           ((gViewStartTick % (gDeciMicroPerPix / 10)) == 0));
 }
 
-
-static void main_util_2Tick(void)
+static void main_util_tiles(void)
 {
-   int64_t x, diffTick;
-
-   if ((g2Tick > gViewStartTick) && (g2Tick < gViewEndTick))
-   {
-      cairo_set_line_width(gCoscCairo, 1.0);
+   piscopeTile_t *tile[PISCOPE_TILES];
+   piscopeRenderJob_t jobs[PISCOPE_TILES];
+   int64_t pix, first;
+   int i, x, y, w, offset, stride, numTiles, numJobs, miss;
+   uint32_t gpios;
+   uint8_t *row;
 
-      cairo_set_source_rgb(gCoscCairo, 1.0, 0.3, 0.3);
+   gpios = 0;
 
-      diffTick = g2Tick - gViewStartTick;
+   for (x=0; x<PISCOPE_GPIOS; x++)
+   {
+      if (gGpioInfo[x].display) gpios |= (1<<x);
+   }
 
-      x = (int64_t)10 * diffTick / (int64_t)gDeciMicroPerPix;
+   pix = gViewStartTick / (gDeciMicroPerPix / 10);
 
-      cairo_move_to(gCoscCairo, x, 0);
+   first    = pix / PISCOPE_TILE_PIX;
+   numTiles = ((pix + gCoscWidth - 1) / PISCOPE_TILE_PIX) - first + 1;
+   numJobs  = 0;
 
-      cairo_line_to(gCoscCairo, x, gCoscHeight);
+   for (i=0; i<numTiles; i++)
+   {
+      tile[i] = main_util_tile(first + i, gpios, &miss);
 
-      cairo_stroke(gCoscCairo);
+      if (miss) jobs[numJobs++].tile = tile[i];
    }
-}
-
 
-static void main_util_GoldTick(void)
-{
-   int64_t x, diffTick;
+   /* the misses of a view new to the cache are drawn in parallel */
 
-   if ((gGoldTick > gViewStartTick) && (gGoldTick < gViewEndTick))
+   if ((gRenderThreads > 1) && (numJobs > 1))
    {
-      cairo_set_line_width(gCoscCairo, 1.0);
+      main_util_renderRun(jobs, numJobs, 2);
+   }
+   else
+   {
+      for (i=0; i<numJobs; i++) main_util_tileDraw(jobs[i].tile);
+   }
+
+   cairo_surface_flush(gWaveSurface);
 
-      cairo_set_source_rgb(gCoscCairo, 1.0, 1.0, 0.3);
+   stride = cairo_image_surface_get_stride(gWaveSurface);
 
-      diffTick = gGoldTick - gViewStartTick;
+   for (x=0, i=0; x<gCoscWidth; x+=w, i++)
+   {
+      offset = (pix + x) % PISCOPE_TILE_PIX;
 
-      x = (int64_t)10 * diffTick / (int64_t)gDeciMicroPerPix;
+      w = PISCOPE_TILE_PIX - offset;
 
-      cairo_move_to(gCoscCairo, x, 0);
+      if (w > (gCoscWidth - x)) w = gCoscWidth - x;
 
-      cairo_line_to(gCoscCairo, x, gCoscHeight);
+      row = cairo_image_surface_get_data(gWaveSurface) + (x * 4);
 
-      cairo_stroke(gCoscCairo);
+      for (y=0; y<gCoscHeight; y++, row+=stride)
+      {
+         memcpy(row,
+            tile[i]->pix + (y * (PISCOPE_TILE_PIX + 2)) + 1 + offset, w * 4);
+      }
    }
-}
 
+   cairo_surface_mark_dirty(gWaveSurface);
 
-static void main_util_BlueTick(void)
-{
-   int64_t x, diffTick;
+   /* the paths of a full view start and stop at its edges */
 
-   if ((gBlueTick > gViewStartTick) && (gBlueTick < gViewEndTick))
-   {
-      cairo_set_line_width(gCoscCairo, 1.0);
+   main_util_strip(0, 1);
+   main_util_strip(gCoscWidth - 1, gCoscWidth);
+}
 
-      cairo_set_source_rgb(gCoscCairo, 0.3, 1.0, 1.0);
+/*
+When a frame runs over its budget the columns are scanned taking
+buckets up to the largest holding no more samples than an average
+column whole, even where they run into the next column, so edges are
+drawn at most a pixel early.  The picture is drawn at full detail again
+once there is time.
+*/
 
-      diffTick = gBlueTick - gViewStartTick;
+static int main_util_coarseLevel(void)
+{
+   int64_t perColumn;
+   int level;
 
-      x = (int64_t)(10 * diffTick) / (int64_t)gDeciMicroPerPix;
+   perColumn = (gViewEndSample - gViewStartSample) / gCoscWidth;
 
-      cairo_move_to(gCoscCairo, x, 0);
+   level = 0;
 
-      cairo_line_to(gCoscCairo, x, gCoscHeight);
+   while ((level < PISCOPE_PYR_LEVELS) &&
+          ((1 << (PISCOPE_PYR_SHIFT * (level+1))) <= perColumn)) level++;
 
-      cairo_stroke(gCoscCairo);
-   }
+   return level;
 }
 
+/*
+Bring the wave surface up to the current view.  When the view has moved
+by whole pixels since the last frame, as it does while live or playing,
+the surface is shifted and only the exposed strip is drawn.
+*/
 
-static void main_util_display(void)
+static void main_util_wave(void)
 {
-   static int rollingAverage = 0;
-   int g, s, millis;
-   int lev1, lev2;
-   struct timeval t1, t2, tDiff;
-
-   int64_t x1, x2, y1, y2, y3;
-   int64_t diffTick;
+   int full, dx, y, stride, minLevel;
+   int64_t delta;
+   uint8_t *row;
 
-   if (rollingAverage > 40)
+   if ((gWaveSurface == NULL) ||
+       (cairo_image_surface_get_width(gWaveSurface)  != gCoscWidth) ||
+       (cairo_image_surface_get_height(gWaveSurface) != gCoscHeight))
    {
-      rollingAverage = ((9 * rollingAverage) / 10);
-      return;
-   }
-
-   gettimeofday(&t1, NULL);
+      if (gWaveCairo)   cairo_destroy(gWaveCairo);
+      if (gWaveSurface) cairo_surface_destroy(gWaveSurface);
 
-   cairo_set_source_rgb(gCoscCairo, 0.0, 0.0, 0.0);
+      gWaveSurface = cairo_image_surface_create
+         (CAIRO_FORMAT_RGB24, gCoscWidth, gCoscHeight);
 
-   cairo_paint(gCoscCairo);
+      gWaveCairo = cairo_create(gWaveSurface);
 
-   for (g=0; g<PISCOPE_GPIOS; g++)
-   {
-      if (gGpioInfo[g].display)
-      {
-         cairo_set_line_width(gCoscCairo, 0.5);
+      gWaveValid = 0;
+   }
 
-         cairo_set_source_rgb(gCoscCairo, 1.0, 1.0, 1.0);
+   if (gFrameCoarse) minLevel = main_util_coarseLevel();
+   else              minLevel = 0;
 
-         cairo_move_to(gCoscCairo, 0, gGpioInfo[g].y_tick);
+   if (minLevel != gWaveMinLevel)
+   {
+      gWaveMinLevel = minLevel;
+      gWaveValid    = 0;
+   }
 
-         cairo_line_to(gCoscCairo, gCoscWidth, gGpioInfo[g].y_tick);
+   dx = 0;
 
-         cairo_stroke(gCoscCairo);
+   /* a full buffer drops its oldest samples, which may be in view */
 
-         cairo_set_line_width(gCoscCairo, 2.0);
+   full = !gWaveValid || (gWaveDeciMicroPerPix != gDeciMicroPerPix) ||
+          (gWaveFirst != gView->first);
 
-         cairo_set_source_rgb(gCoscCairo, 0.2, 0.6, 0.1);
+   if (!full)
+   {
+      delta = (gViewStartTick - gWaveStartTick) * 10;
 
-         s = gViewStartSample;
+      if (delta % gDeciMicroPerPix) full = 1;
+      else
+      {
+         delta /= gDeciMicroPerPix;
 
-         lev1 = gSampleLevel[s] & (1<<g);
+         if ((delta >= gCoscWidth) || (delta <= -gCoscWidth)) full = 1;
+         else dx = delta;
+      }
+   }
 
-         x1 = 0;
-         y1 = 0;
+   if ((full || dx) && main_util_tiled()) main_util_tiles();
 
-         y2 = 0;
+   else if (full) main_util_strip(0, gCoscWidth);
 
-         if (lev1 == 0) y1 = gGpioInfo[g].y_low;
-         else           y1 = gGpioInfo[g].y_high;
+   else if (dx)
+   {
+      cairo_surface_flush(gWaveSurface);
 
-         cairo_move_to(gCoscCairo, x1, y1);
+      row    = cairo_image_surface_get_data(gWaveSurface);
+      stride = cairo_image_surface_get_stride(gWaveSurface);
 
-         y3 = -1;
+      for (y=0; y<gCoscHeight; y++, row+=stride)
+      {
+         if (dx > 0) memmove(row, row + (dx * 4), (gCoscWidth - dx) * 4);
+         else        memmove(row - (dx * 4), row, (gCoscWidth + dx) * 4);
+      }
 
-         while (s != gViewEndSample)
-         {
-            if (++s >= PISCOPE_SAMPLES) s = 0;
+      cairo_surface_mark_dirty(gWaveSurface);
 
-            lev2 = gSampleLevel[s] & (1<<g);
+      /* the pixels at either end of a path depend on where it starts
+         and stops, so the old and new edge pixels are drawn again */
 
-            if (lev1 != lev2)
-            {
-               /* line height change */
+      if (dx > 0)
+      {
+         main_util_strip(0, 1);
+         main_util_strip(gCoscWidth - dx - 1, gCoscWidth);
+      }
+      else
+      {
+         main_util_strip(0, 1 - dx);
+         main_util_strip(gCoscWidth - 1, gCoscWidth);
+      }
+   }
 
-               diffTick = gSampleTick[s] - gViewStartTick;
+   gWaveValid           = 1;
+   gWaveStartTick       = gViewStartTick;
+   gWaveDeciMicroPerPix = gDeciMicroPerPix;
+   gWaveFirst           = gView->first;
+}
 
-               x2 = (int64_t)(10 * diffTick) / (int64_t)gDeciMicroPerPix;
+static void main_util_display(void)
+{
+   int micros;
+   struct timeval t1, t2, tDiff;
+   int64_t t;
 
-               if (x2 != x1)
-               {
-                  if (y3 != -1)
-                  {
-                     cairo_move_to(gCoscCairo, x1, y3);
-                     y1 = y3;
-                     y3 = -1;
-                  }
+   /* the frame is always drawn.  A frame over its budget drops the detail
+      for a second, which runs on while frames take over half of it */
 
-                  cairo_line_to(gCoscCairo, x2, y1);
+   if (gFrameLoad > gFrameMicros) gFrameCoarse = gOutputUpdateHz;
 
-                  if (lev2 == 0) y2 = gGpioInfo[g].y_low;
-                  else           y2 = gGpioInfo[g].y_high;
+   else if (gFrameCoarse && (gFrameLoad < (gFrameMicros / 2))) gFrameCoarse--;
 
-                  cairo_line_to(gCoscCairo, x2, y2);
-               }
-               else
-               {
-                  if (lev2 == 0) y3 = gGpioInfo[g].y_low;
-                  else           y3 = gGpioInfo[g].y_high;
-               }
+   if (gFrameCoarse) gHudCoarse++;
 
-               lev1 = lev2;
-               x1   = x2;
-               y1   = y2;
-            }
-         }
+   t = trace_begin();
 
-         if (y3 != -1)
-         {
-            cairo_move_to(gCoscCairo, x1, y3);
-            y1 = y3;
-            y3 = -1;
-         }
+   gettimeofday(&t1, NULL);
 
-         /* finish line at screen edge */
+   main_util_wave();
 
-         cairo_line_to(gCoscCairo, gCoscWidth, y1);
+   cairo_set_source_surface(gCoscCairo, gWaveSurface, 0, 0);
 
-         cairo_stroke(gCoscCairo);
-      }
-   }
+   cairo_paint(gCoscCairo);
 
    main_util_GoldTick();
 
@@ -2406,6 +6568,8 @@ static void main_util_display(void)
 
    main_util_2Tick();
 
+   main_util_gaps();
+
    /* redraw screen */
 
    gtk_widget_queue_draw(gMainCosc);
@@ -2414,26 +6578,33 @@ static void main_util_display(void)
 
    timersub(&t2, &t1, &tDiff);
 
-   millis = ((tDiff.tv_sec * PISCOPE_MILLION) + tDiff.tv_usec) / 1000;
+   micros = (tDiff.tv_sec * PISCOPE_MILLION) + tDiff.tv_usec;
+
+   hud_frame(micros);
+
+   gFrameLoad  = gFrameInput + micros;
+   gFrameInput = 0;
 
-   rollingAverage = ((9 * rollingAverage) + millis) / 10;
+   trace_end(&gTraceUI, "display", t, gViewEndSample - gViewStartSample + 1);
 }
 
 static void main_util_samp_show(void)
 {
    cairo_t *cr;
    int bufUsedPix;
-   int width, start, widthPix,startPix;
+   int widthPix, startPix;
+   int64_t width, start, capacity, t;
 
-   width = gViewEndSample - gViewStartSample;
-   start = gViewStartSample - gBufReadPos;
+   t = trace_begin();
+
+   capacity = store_capacity(gView);
 
-   if (width < 0) width += PISCOPE_SAMPLES;
-   if (start < 0) start += PISCOPE_SAMPLES;
+   width = gViewEndSample - gViewStartSample;
+   start = gViewStartSample - gView->first;
 
-   startPix   = (gCsampWidth * start)       / PISCOPE_SAMPLES;
-   widthPix   = (gCsampWidth * width)       / PISCOPE_SAMPLES;
-   bufUsedPix = (gCsampWidth * gBufSamples) / PISCOPE_SAMPLES;
+   startPix   = (gCsampWidth * start)                         / capacity;
+   widthPix   = (gCsampWidth * width)                         / capacity;
+   bufUsedPix = (gCsampWidth * (gView->next - gView->first)) / capacity;
 
    if (widthPix < 2) widthPix = 2;
 
@@ -2458,58 +6629,125 @@ static void main_util_samp_show(void)
    cairo_destroy(cr);
 
    gtk_widget_queue_draw(gMainCbuf);
+
+   trace_end(&gTraceUI, "samp_show", t, 0);
 }
 
 
-static gboolean main_util_output(gpointer data)
+/* reports lost by pigpiod per second, usually because piscope fell behind */
+
+static void main_util_lossShow(void)
 {
-   int decimals, blue;
-   char buf[128];
+   static gint64 lastTime;
+   static uint64_t lastLost;
 
-   if (gOutputState == piscope_initialise)
-      gOutputState = piscope_running;
+   double secs;
+   char buf[256];
 
-   else if (gOutputState == piscope_quit)
+   secs = util_everySecond(&lastTime);
+
+   if (secs > 0.0)
    {
-      gtk_main_quit();
-      return FALSE;
+      sprintf(buf, "%.0f lost/s", (gIngest.lost - lastLost) / secs);
+
+      util_labelText(gMainLloss, buf);
+
+      sprintf(buf,
+         "%llu reports lost in %llu gaps\n"
+         "%d capture ring stalls\n"
+         "%llu watchdog, %llu keep alive reports",
+         (unsigned long long)gIngest.lost, (unsigned long long)gIngest.gaps,
+         g_atomic_int_get(&gCapStalls),
+         (unsigned long long)gIngest.watchdogs,
+         (unsigned long long)gIngest.alives);
+
+      gtk_widget_set_tooltip_text(gMainLloss, buf);
    }
 
-   else if (gOutputState == piscope_dormant)
-      return TRUE;
+   if (secs != 0.0) lastLost = gIngest.lost;
+}
 
-   /* don't start display until data has arrived */
+/*
+Round a view end down to a whole pixel, so successive live and play
+frames differ by whole pixels and main_util_wave can scroll.
+*/
+
+static int64_t main_util_pixelFloor(int64_t tick)
+{
+   int64_t pix;
+
+   if (gDeciMicroPerPix % 10) return tick;
+
+   pix = gDeciMicroPerPix / 10;
+
+   return tick - (tick % pix);
+}
+
+static void main_util_frameRate(int rate)
+{
+   gOutputUpdateHz = rate;
+
+   gFrameMicros = PISCOPE_MILLION / gOutputUpdateHz;
 
-   if (gBufWritePos < 0) return TRUE;
+   gFrameElapsed = gFrameMicros;
 
-   gFirstReportTick = gSampleTick[gBufReadPos];
-   gLastReportTick  = gSampleTick[gBufWritePos];
+   gTimeSlotMicros = PISCOPE_MILLION / (gInputUpdateHz + (4*gOutputUpdateHz));
+
+   gRefreshTicks = gFrameMicros;
+}
+
+/*
+Place the view for the mode, on the newest samples while live, moving
+on while playing and where it was left while paused, then find the
+samples either end of it.
+*/
+
+static void main_util_view(void)
+{
+   int64_t first, last;
+
+   first = gView->first;
+   last  = gView->next - 1;
+
+   gFirstReportTick = store_tick(gView, first);
+   gLastReportTick  = store_tick(gView, last);
 
    if (gMode == piscope_live)
    {
-      decimals = 1;
-      blue = 1;
+      if (gLockPending &&
+          (gLastReportTick >= (gLockPending + (gViewTicks/2))))
+      {
+         gLockTick = gLockPending;
+      }
 
-      gViewEndTick =
-         (gLastReportTick / gRefreshTicks) * gRefreshTicks;
+      if ((gTrigRepeat != piscope_single) && gLockTick &&
+          ((gTrigRepeat == piscope_normal) ||
+           (gLastReportTick < (gLockTick + gViewTicks + PISCOPE_AUTO_TICKS))))
+      {
+         /* trigger locked, the trigger is held at the centre */
 
-      gViewCentreTick = gViewEndTick - (gViewTicks/2);
+         gViewCentreTick = gLockTick;
+
+         gViewEndTick    = gViewCentreTick + (gViewTicks/2);
+      }
+      else
+      {
+         gViewEndTick = main_util_pixelFloor
+            ((gLastReportTick / gRefreshTicks) * gRefreshTicks);
+
+         gViewCentreTick = gViewEndTick - (gViewTicks/2);
+      }
 
       gViewStartTick  = gViewEndTick - gViewTicks;
    }
    else if (gMode == piscope_play)
    {
-      decimals = (gPlaySpeed / 3) - 1;
-
-      if      (decimals < 0) decimals = 0;
-      else if (decimals > 6) decimals = 6;
-
-      blue = 1;
+      /* by the time since the last frame, frames may come late */
 
-      gViewCentreTick +=
-         ((gRefreshTicks * (1<<PISCOPE_DEF_SPEED_IDX))/(1<<gPlaySpeed));
+      gViewCentreTick += ((int64_t)gFrameElapsed *
+         (1<<PISCOPE_DEF_SPEED_IDX)) / (1<<gPlaySpeed);
 
-      gViewEndTick   = gViewCentreTick + (gViewTicks/2);
+      gViewEndTick   = main_util_pixelFloor(gViewCentreTick + (gViewTicks/2));
 
       gViewStartTick = gViewEndTick    - gViewTicks;
    }
@@ -2517,44 +6755,86 @@ static gboolean main_util_output(gpointer data)
    {
       /* MODE_PAUSE */
 
-      decimals = 6;
-      blue = 0;
+      /* on whole pixels so the view can be put together from tiles */
 
-      gViewEndTick   = gViewCentreTick + (gViewTicks/2);
+      gViewEndTick   = main_util_pixelFloor(gViewCentreTick + (gViewTicks/2));
 
       gViewStartTick = gViewEndTick    - gViewTicks;
    }
 
    if (gViewStartTick > gFirstReportTick)
    {
-      gViewStartSample =
-         main_util_bsearch(gBufReadPos, gBufWritePos, &gViewStartTick);
+      gViewStartSample = main_util_bsearch(first, last, &gViewStartTick);
    }
    else
    {
-      gViewStartSample = gBufReadPos;
+      gViewStartSample = first;
       gViewStartTick   = gFirstReportTick;
       gViewEndTick     = gViewStartTick + gViewTicks;
       gViewCentreTick  = gViewEndTick   - (gViewTicks/2);
    }
 
-   if (gViewStartSample != gBufReadPos)
-   {
-     if (--gViewStartSample < 0) gViewStartSample = PISCOPE_SAMPLES - 1;
-   }
+   if (gViewStartSample != first) --gViewStartSample;
 
    if (gViewEndTick < gLastReportTick)
    {
-      gViewEndSample =
-         main_util_bsearch(gBufReadPos, gBufWritePos, &gViewEndTick);
+      gViewEndSample = main_util_bsearch(first, last, &gViewEndTick);
    }
    else
    {
-      gViewEndSample  = gBufWritePos;
+      gViewEndSample  = last;
       gViewEndTick    = gLastReportTick;
       gViewStartTick  = gViewEndTick - gViewTicks;
       gViewCentreTick = gViewEndTick - (gViewTicks/2);
    }
+}
+
+static gboolean main_util_output(gpointer data)
+{
+   int decimals, blue;
+   int64_t t;
+   uint64_t arrival;
+   char buf[128];
+
+   if (gOutputState == piscope_initialise)
+      gOutputState = piscope_running;
+
+   else if (gOutputState == piscope_quit)
+   {
+      gtk_main_quit();
+      return FALSE;
+   }
+
+   else if (gOutputState == piscope_dormant)
+      return TRUE;
+
+   /* don't start display until data has arrived */
+
+   if (gView->next == gView->first) return TRUE;
+
+   t = trace_begin();
+
+   main_util_view();
+
+   if (gMode == piscope_live)
+   {
+      decimals = 1;
+      blue = 1;
+   }
+   else if (gMode == piscope_play)
+   {
+      decimals = (gPlaySpeed / 3) - 1;
+
+      if      (decimals < 0) decimals = 0;
+      else if (decimals > 6) decimals = 6;
+
+      blue = 1;
+   }
+   else
+   {
+      decimals = 6;
+      blue = 0;
+   }
 
    main_util_display();
    main_util_samp_show();
@@ -2565,9 +6845,65 @@ static gboolean main_util_output(gpointer data)
 
    trig_countsShow();
 
+   trig_rateShow();
+
+   main_util_lossShow();
+
+   hud_update();
+
+   arrival = __atomic_load_n(&gCapArrival, __ATOMIC_RELAXED);
+
+   if (t && arrival && (gMode == piscope_live))
+   {
+      /* from the pigpiod tick of the newest report taken in to it being
+         drawn, timed from when the capture thread read the newest report.
+         Watchdog and keep-alive reports count, so a quiet bus shows no
+         lag that is only the time since the last edge. */
+
+      trace_counter(&gTraceUI, "tick lag us",
+         (int32_t)((uint32_t)(trace_now() / 1000) - (uint32_t)arrival) +
+         (int32_t)((uint32_t)(arrival >> 32) - gIngest.lastTick));
+   }
+
+   trace_end(&gTraceUI, "output", t, gView->next - gView->first);
+
    return TRUE;
 }
 
+/*
+Frames are drawn on the widget frame clock, which ticks at the display
+refresh.  A tick within half a refresh of when a frame is due draws it,
+so a frame rate at the refresh rate draws on every tick.  A frame that
+is late is not made up.
+*/
+
+static gboolean main_util_tick
+   (GtkWidget *widget, GdkFrameClock *clock, gpointer data)
+{
+   gint64 now, refresh;
+
+   now = gdk_frame_clock_get_frame_time(clock);
+
+   gdk_frame_clock_get_refresh_info(clock, now, &refresh, NULL);
+
+   if (now < (gFrameDue - (refresh / 2))) return TRUE;
+
+   gFrameDue += gFrameMicros;
+
+   if (gFrameDue < now) gFrameDue = now + gFrameMicros;
+
+   /* a stall is not played through at once */
+
+   gFrameElapsed = now - gFrameLast;
+
+   if (!gFrameLast || (gFrameElapsed > (4 * gFrameMicros)))
+      gFrameElapsed = gFrameMicros;
+
+   gFrameLast = now;
+
+   return main_util_output(NULL);
+}
+
 /* MAIN HLEG -------------------------------------------------------------- */
 
 gboolean main_hleg_draw(GtkWidget *widget, cairo_t *cr, gpointer data)
@@ -2644,6 +6980,13 @@ gboolean main_osc_configure_event
 
    gCoscHeight = gtk_widget_get_allocated_height(widget);
 
+   if (gCoscWidth > gColAlloc)
+   {
+      gColAlloc = gCoscWidth;
+      gColEdges = g_realloc(gColEdges, gColAlloc * sizeof(uint32_t));
+      gColLevel = g_realloc(gColLevel, gColAlloc * sizeof(uint32_t));
+   }
+
    util_calcGpioY();
 
    if (gCoscSurface) cairo_surface_destroy(gCoscSurface);
@@ -2676,6 +7019,8 @@ gboolean main_osc_draw(GtkWidget *widget, cairo_t *cr, gpointer data)
       cairo_paint(cr);
    }
 
+   hud_draw(cr);
+
    return FALSE;
 }
 
@@ -2749,23 +7094,24 @@ gboolean main_osc_button_press_event(
 gboolean main_samp_button_press_event(
    GtkWidget *widget, GdkEventButton *event, gpointer user_data)
 {
-   int sample;
+   int64_t sample;
 
-   sample = (event->x * PISCOPE_SAMPLES) / gCsampWidth;
+   if (gView->next == gView->first) return TRUE;
 
-   if (sample >= gBufSamples) sample = gBufSamples - 1;
+   sample = (event->x * store_capacity(gView)) / gCsampWidth;
 
-   if (sample < 0) sample = 0;
+   if (sample >= (gView->next - gView->first))
+      sample = gView->next - gView->first - 1;
 
-   sample += gBufReadPos;
+   if (sample < 0) sample = 0;
 
-   if (sample >= PISCOPE_SAMPLES) sample -= PISCOPE_SAMPLES;
+   sample += gView->first;
 
    if (event->type == GDK_BUTTON_PRESS)
    {
       if (gMode == piscope_pause)
       {
-         gViewCentreTick = gSampleTick[sample];
+         gViewCentreTick = store_tick(gView, sample);
 
          gGoldTick = gViewCentreTick;
 
@@ -2776,7 +7122,7 @@ gboolean main_samp_button_press_event(
    {
       gtk_toggle_tool_button_set_active(GTK_TOGGLE_TOOL_BUTTON(gMainTBpause), TRUE);
 
-      gViewCentreTick = gSampleTick[sample];
+      gViewCentreTick = store_tick(gView, sample);
 
       gGoldTick = gViewCentreTick;
 
@@ -2838,8 +7184,12 @@ void main_destroy(void)
    gInputState  = piscope_quit;
    gOutputState = piscope_quit;
 
+   capture_stop();
+
    if (gPigSocket >= 0)
    {
+      pigpioSetWatchdogs(0);
+
       if (gPigHandle >= 0)
       {
          pigpioCommand(gPigSocket, PI_CMD_NC, gPigHandle, 0);
@@ -3169,7 +7519,8 @@ void main_tb_first_clicked(GtkButton * button, gpointer user_data)
 
    gtk_toggle_tool_button_set_active(GTK_TOGGLE_TOOL_BUTTON(gMainTBpause), TRUE);
 
-   gViewCentreTick = gSampleTick[gBufReadPos] + (gViewTicks/2);
+   if (gView->next > gView->first)
+      gViewCentreTick = store_tick(gView, gView->first) + (gViewTicks/2);
 }
 
 void main_tb_last_clicked(GtkButton * button, gpointer user_data)
@@ -3178,7 +7529,8 @@ void main_tb_last_clicked(GtkButton * button, gpointer user_data)
 
    gtk_toggle_tool_button_set_active(GTK_TOGGLE_TOOL_BUTTON(gMainTBpause), TRUE);
 
-   gViewCentreTick = gSampleTick[gBufWritePos] - (gViewTicks/2);
+   if (gView->next > gView->first)
+      gViewCentreTick = store_tick(gView, gView->next-1) - (gViewTicks/2);
 }
 
 void main_tb_back_clicked(GtkButton * button, gpointer user_data)
@@ -3258,6 +7610,10 @@ gboolean main_vleg_button_press_event(
 gboolean main_key_press_event(
    GtkWidget *widget, GdkEventKey *event, gpointer user_data)
 {
+   char buf[64];
+   time_t now;
+   int err;
+
    switch (event->keyval)
    {
       case GDK_KEY_bracketleft:
@@ -3268,6 +7624,14 @@ gboolean main_key_press_event(
          if (gMode == piscope_pause) main_util_searchTrigger(1);
          break;
 
+      case GDK_KEY_comma:
+         if (gMode == piscope_pause) main_util_searchWindow(0);
+         break;
+
+      case GDK_KEY_period:
+         if (gMode == piscope_pause) main_util_searchWindow(1);
+         break;
+
       case GDK_KEY_Left:
          if (gMode == piscope_pause) main_util_searchEdge(0);
          break;
@@ -3354,6 +7718,30 @@ gboolean main_key_press_event(
       case GDK_KEY_G:
          gGoldTick = gBlueTick;
          break;
+
+      case GDK_KEY_t:
+         if (!g_atomic_int_get(&gTraceOn)) trace_start();
+         else
+         {
+            now = time(NULL);
+
+            strftime(buf, sizeof(buf), "piscope-%Y%m%d-%H%M%S.trace.json",
+               localtime(&now));
+
+            if ((err = trace_stop(buf)))
+               util_popupMessage(GTK_MESSAGE_WARNING, GTK_BUTTONS_CLOSE,
+                  "can't write %s\n%s", buf, strerror(err));
+            else
+               util_popupMessage(GTK_MESSAGE_INFO, GTK_BUTTONS_CLOSE,
+                  "trace written to %s", buf);
+         }
+         break;
+
+      case GDK_KEY_h:
+         gHud = !gHud;
+         gHudLines = 0;
+         gtk_widget_queue_draw(gMainCosc);
+         break;
    }
 
   return FALSE;
@@ -3390,6 +7778,10 @@ int main(int argc, char *argv[])
 
    gtk_init(&argc, &argv);
 
+   ingest_init();
+
+   raster_init();
+
    pigpioLoadSettings();
 
   /* Construct a GtkBuilder instance and load our UI description */
@@ -3429,6 +7821,10 @@ int main(int argc, char *argv[])
    PISCOPE_BUILDOBJ(gCmdsDialog);
    PISCOPE_BUILDOBJ(gCmdsPigpioAddr);
    PISCOPE_BUILDOBJ(gCmdsPigpioPort);
+   PISCOPE_BUILDOBJ(gCmdsBufferMB);
+   PISCOPE_BUILDOBJ(gCmdsFrameRate);
+   PISCOPE_BUILDOBJ(gCmdsCaptureFile);
+   PISCOPE_BUILDOBJ(gCmdsCaptureMB);
    PISCOPE_BUILDOBJ(gCmdsPlayspeed);
 
    PISCOPE_BUILDOBJ(gGpioDialog);
@@ -3446,6 +7842,8 @@ int main(int argc, char *argv[])
    PISCOPE_BUILDOBJ(gMainLmode);
    PISCOPE_BUILDOBJ(gMainLtime);
    PISCOPE_BUILDOBJ(gMainLtrigs);
+   PISCOPE_BUILDOBJ(gMainLrate);
+   PISCOPE_BUILDOBJ(gMainLloss);
 
    PISCOPE_BUILDOBJ(gMainTBconnect);
    PISCOPE_BUILDOBJ(gMainTBlive);
@@ -3454,6 +7852,7 @@ int main(int argc, char *argv[])
 
    PISCOPE_BUILDOBJ(gTrigDialog);
    PISCOPE_BUILDOBJ(gTrigLabel);
+   PISCOPE_BUILDOBJ(gTrigMicros);
 
    PISCOPE_BUILDOBJ(gTrgsDialog);
    PISCOPE_BUILDOBJ(gTrgsSamples);
@@ -3466,6 +7865,28 @@ int main(int argc, char *argv[])
 
    gtk_combo_box_set_active(GTK_COMBO_BOX(gTrgsSamples), 0);
 
+   PISCOPE_BUILDOBJ(gTrgsWindows);
+
+   for (j=0; j<sizeof(gTrigWindowsText)/sizeof(gTrigWindowsText[0]); j++)
+   {
+      gtk_combo_box_text_insert_text
+         (GTK_COMBO_BOX_TEXT(gTrgsWindows), j, gTrigWindowsText[j]);
+   }
+
+   gtk_combo_box_set_active(GTK_COMBO_BOX(gTrgsWindows), 0);
+
+   PISCOPE_BUILDOBJ(gTrgsRepeat);
+
+   for (j=0; j<sizeof(gTrigRepeatText)/sizeof(gTrigRepeatText[0]); j++)
+   {
+      gtk_combo_box_text_insert_text
+         (GTK_COMBO_BOX_TEXT(gTrgsRepeat), j, gTrigRepeatText[j]);
+   }
+
+   gtk_combo_box_set_active(GTK_COMBO_BOX(gTrgsRepeat), 0);
+
+   PISCOPE_BUILDOBJ(gTrgsHoldoff);
+
    for (i=0; i<PISCOPE_TRIGGERS; i++)
    {
       sprintf(buf, "trgs_on%d", i+1);
@@ -3559,18 +7980,18 @@ int main(int argc, char *argv[])
 
    gtk_widget_show_all((GtkWidget*)gMain);
 
-   gTimeSlotMicros = PISCOPE_MILLION / (gInputUpdateHz + (4*gOutputUpdateHz));
-
-   gRefreshTicks = PISCOPE_MILLION / gOutputUpdateHz;
+   main_util_frameRate(gSettings.frameRate);
 
    g_timeout_add(1000/gInputUpdateHz, main_util_input, NULL);
 
-   g_timeout_add(1000/gOutputUpdateHz, main_util_output, NULL);
+   gtk_widget_add_tick_callback(gMainCosc, main_util_tick, NULL, NULL);
 
    /* definitely done with the builder */
 
    g_object_unref(G_OBJECT(builder));
 
+   cmds_storeInit();
+
    pigpioConnect();
 
    gtk_main();
@@ -3578,6 +7999,8 @@ int main(int argc, char *argv[])
    /* free resources */
 
    if (gCoscSurface)  cairo_surface_destroy(gCoscSurface);
+   if (gWaveCairo)    cairo_destroy(gWaveCairo);
+   if (gWaveSurface)  cairo_surface_destroy(gWaveSurface);
    if (gChlegSurface) cairo_surface_destroy(gChlegSurface);
    if (gCvlegSurface) cairo_surface_destroy(gCvlegSurface);
    if (gCsampSurface)  cairo_surface_destroy(gCsampSurface);
@@ -3587,5 +8010,10 @@ int main(int argc, char *argv[])
 
    gtk_widget_destroy(GTK_WIDGET(gCmdsDialog));
 
+   store_free(&gSnap);
+   store_free(&gStore);
+
+   for (i=0; i<PISCOPE_TILES; i++) g_free(gTile[i].pix);
+
    return 0;
 }
@@ -42,15 +42,34 @@ For more information, please refer to <http://unlicense.org/>
 #define SETTINGS_SERVER_PORT "serverPort"
 #define SETTINGS_ACTIVE_GPIOS "activeGPIOs"
 #define SETTINGS_TRIGGER_SAMPLES "triggerSamples"
+#define SETTINGS_TRIGGER_WINDOWS "triggerWindows"
+#define SETTINGS_TRIGGER_REPEAT "triggerRepeat"
+#define SETTINGS_TRIGGER_HOLDOFF "triggerHoldoffMicros"
+#define SETTINGS_BUFFER_MB "bufferMB"
+#define SETTINGS_CAPTURE_FILE "captureFile"
+#define SETTINGS_CAPTURE_MB "captureFileMB"
+#define SETTINGS_FRAME_RATE "frameRate"
 #define SETTINGS_TRIGGER_ENABLED "trigger%dEnabled"
 #define SETTINGS_TRIGGER_ACTION "trigger%dAction"
 #define SETTINGS_TRIGGER_GPIO_TYPES "trigger%dGPIOTypes"
+#define SETTINGS_TRIGGER_MICROS "trigger%dMicros"
+#define SETTINGS_COUNTER_NAME "counter%dName"
+#define SETTINGS_COUNTER_GPIO_TYPES "counter%dGPIOTypes"
+#define SETTINGS_SEQUENCE_NAME "sequence%dName"
+#define SETTINGS_SEQUENCE_ACTION "sequence%dAction"
+#define SETTINGS_STAGE_GPIO_TYPES "sequence%dStage%dGPIOTypes"
+#define SETTINGS_STAGE_HOLD_TYPES "sequence%dStage%dHoldGPIOTypes"
+#define SETTINGS_STAGE_REPEAT "sequence%dStage%dRepeat"
+#define SETTINGS_STAGE_WITHIN "sequence%dStage%dWithinMicros"
 
+#define PI_CMD_WDOG   9
 #define PI_CMD_HWVER 17
 #define PI_CMD_NB    19
 #define PI_CMD_NC    21
 #define PI_CMD_NOIB  99
 
+#define PI_MAX_WDOG_TIMEOUT 60000
+
 typedef struct
 {
    uint16_t seqno;
@@ -59,6 +78,11 @@ typedef struct
    uint32_t level;
 } gpioReport_t;
 
+#define PI_NTFY_FLAGS_EVENT    (1 <<7)
+#define PI_NTFY_FLAGS_ALIVE    (1 <<6)
+#define PI_NTFY_FLAGS_WDOG     (1 <<5)
+#define PI_NTFY_FLAGS_BIT(x) (((x)<<0)&31)
+
 /* from pigpio command.h */
 
 typedef struct
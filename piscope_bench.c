@@ -0,0 +1,1802 @@
+/*
+piscope_bench.c
+
+Benchmarks for piscope, run without a Pi or a display.
+
+piscope.c is included whole so its static functions can be driven
+directly.  No GTK widgets exist, the few GTK calls the ingest and
+drawing code make on them are silently ignored.
+
+piscope_bench stream [-r edges/s] [-c channels] [-m clock|random]
+                     [-t seconds] [-b MB]
+
+   Starts a fake pigpiod on a local port which speaks enough of the
+   command protocol (HWVER, NOIB, NB, NC) for piscope to connect, then
+   streams reports at the edge rate.  Without -r the rate is doubled
+   until piscope can no longer keep up.  For each rate the report lag,
+   and the times taken by main_util_input and main_util_display, are
+   printed.
+
+piscope_bench micro [-n samples] [-c channels] [-m clock|random]
+                    [file.piscope ...]
+
+   Times the ingest path (main_util_input and each ingest kernel), the
+   trigger and counter match, main_util_bsearch, main_util_searchEdge
+   and main_util_display drawing to an offscreen image, over a
+   synthetic buffer of 2M samples and then over each recorded file.
+   Prints ns per operation and samples per second.  Each kernel is first
+   checked against ingest_scalar over random report runs, and the idle
+   trigger hits indexed live against those of hits_rebuild, over reports
+   with quiet stretches batched two ways.  The exit status is 1 if any
+   differs.
+
+piscope_bench render [-p pans] [-r repeats] [-w width] [-h height]
+                     [-n samples] [-o sums] [-k sums] [file.piscope ...]
+
+   Draws each capture with main_util_display at every zoom level and at
+   -p pan positions, -r times each.  Frame latency percentiles are
+   printed per zoom level.  A checksum of the pixels of every frame is
+   written to the -o file, a line of zoom, pan, checksum and capture
+   name each, or compared against one written earlier with -k, in which
+   case the exit status is 1 if any frame differs or has no checksum
+   there, or if the file can't be read.  Each zoom level is then panned across untimed and
+   back timed, the way back copied from the pause mode tiles still
+   cached, and a frame which differs from the way out is a mismatch too.
+   With no captures, or with -n, a synthetic buffer is drawn first.
+*/
+
+#define main piscope_main
+#include "piscope.c"
+#undef main
+
+#include <inttypes.h>
+#include <math.h>
+#include <netinet/in.h>
+
+#define BENCH_FAKE_HWVER     0xa02082 /* a Pi 3 */
+#define BENCH_FAKE_CHUNK         4096 /* reports per send */
+#define BENCH_LAG_LIMIT_MS        100 /* lag at which a rate is failed */
+#define BENCH_WIDTH              1000
+#define BENCH_HEIGHT              600
+#define BENCH_KERNEL_RUNS        2000 /* random runs checked per kernel */
+#define BENCH_IDLE_REPORTS      50000 /* reports of the idle trigger check */
+
+typedef enum
+{
+   bench_clock,  /* channel n toggles half as often as channel n-1 */
+   bench_random,
+} benchMix_t;
+
+/* fake pigpiod */
+
+static int           bFakeListen;
+static int           bFakePort;
+static volatile gint bFakeRate;
+static volatile gint bFakeBits;
+static int           bFakeChannels;
+static benchMix_t    bFakeMix;
+static volatile gint64 bFakeStart; /* monotonic micros of first report */
+
+/* BENCH UTIL ------------------------------------------------------------- */
+
+static void bench_quiet
+   (const gchar *domain, GLogLevelFlags level, const gchar *msg, gpointer data)
+{
+}
+
+static double bench_now(void)
+{
+   return g_get_monotonic_time() / 1e6;
+}
+
+static int bench_cmpDouble(const void *a, const void *b)
+{
+   double x = *(const double *)a, y = *(const double *)b;
+
+   return (x > y) - (x < y);
+}
+
+/* the p-th percentile of the values in a, which is sorted */
+
+static double bench_percentile(GArray *a, double p)
+{
+   int i;
+
+   if (!a->len) return 0.0;
+
+   i = (int)ceil((p / 100.0) * a->len) - 1;
+
+   if (i < 0) i = 0;
+
+   return g_array_index(a, double, i);
+}
+
+static void bench_stats(const char *name, GArray *a, double scale, const char *unit)
+{
+   double sum;
+   int i;
+
+   if (!a->len)
+   {
+      printf("   %-8s none\n", name);
+      return;
+   }
+
+   qsort(a->data, a->len, sizeof(double), bench_cmpDouble);
+
+   for (i=0, sum=0.0; i<a->len; i++) sum += g_array_index(a, double, i);
+
+   printf("   %-8s n %6d  mean %9.3f  p50 %9.3f  p99 %9.3f  max %9.3f %s\n",
+      name, a->len, scale * sum / a->len,
+      scale * bench_percentile(a, 50.0), scale * bench_percentile(a, 99.0),
+      scale * g_array_index(a, double, a->len - 1), unit);
+}
+
+/* an offscreen waveform area showing the first gpios */
+
+static void bench_surface(int width, int height, int gpios)
+{
+   int g, pix, y;
+
+   gCoscWidth  = width;
+   gCoscHeight = height;
+
+   gViewTicks = (((int64_t)gCoscWidth * gDeciMicroPerPix)/10);
+
+   gColAlloc = gCoscWidth;
+   gColEdges = g_realloc(gColEdges, gColAlloc * sizeof(uint32_t));
+   gColLevel = g_realloc(gColLevel, gColAlloc * sizeof(uint32_t));
+
+   if (gCoscCairo)   cairo_destroy(gCoscCairo);
+   if (gCoscSurface) cairo_surface_destroy(gCoscSurface);
+
+   gCoscSurface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+   gCoscCairo   = cairo_create(gCoscSurface);
+
+   gDisplayedGpios = gpios;
+
+   gWaveValid = 0;
+
+   pix = gCoscHeight / gpios;
+   y = pix;
+
+   for (g=0; g<PISCOPE_GPIOS; g++)
+   {
+      gGpioInfo[g].display = (g < gpios);
+
+      if (gGpioInfo[g].display)
+      {
+         gGpioInfo[g].y_high = y-pix+2;
+         gGpioInfo[g].y_low  = y-2;
+         gGpioInfo[g].y_tick = y;
+         y += pix;
+      }
+   }
+}
+
+static void bench_init(int bufferMB)
+{
+   g_log_set_handler("Gtk", G_LOG_LEVEL_CRITICAL | G_LOG_LEVEL_WARNING,
+      bench_quiet, NULL);
+   g_log_set_handler("Gdk", G_LOG_LEVEL_CRITICAL | G_LOG_LEVEL_WARNING,
+      bench_quiet, NULL);
+   g_log_set_handler("GLib-GObject", G_LOG_LEVEL_CRITICAL, bench_quiet, NULL);
+
+   ingest_init();
+
+   raster_init();
+
+   store_init(&gStore, bufferMB, NULL);
+
+   engine_compile();
+
+   main_util_frameRate(gOutputUpdateHz);
+}
+
+/* FAKE PIGPIOD ----------------------------------------------------------- */
+
+/* the gpio toggled by the n'th report */
+
+static int fake_gpio(uint32_t n)
+{
+   int c;
+
+   if (bFakeMix == bench_clock) c = __builtin_ctz(n + 1) % bFakeChannels;
+   else                         c = rand() % bFakeChannels;
+
+   return c;
+}
+
+static void fake_stream(int fd)
+{
+   gpioReport_t report[BENCH_FAKE_CHUNK];
+   uint32_t level, n;
+   uint16_t seqno;
+   int64_t due, sent;
+   double tick, step;
+   gint64 start;
+   int i, count, rate;
+
+   while (!g_atomic_int_get(&bFakeBits)) g_usleep(1000);
+
+   rate  = g_atomic_int_get(&bFakeRate);
+   step  = (double)PISCOPE_MILLION / rate;
+   tick  = 0.0;
+   level = 0;
+   seqno = 0;
+   sent  = 0;
+   n     = 0;
+
+   start = g_get_monotonic_time();
+
+   __atomic_store_n(&bFakeStart, start, __ATOMIC_RELEASE);
+
+   while (g_atomic_int_get(&bFakeBits))
+   {
+      due = ((g_get_monotonic_time() - start) * rate) / PISCOPE_MILLION - sent;
+
+      if (due <= 0)
+      {
+         g_usleep(200);
+         continue;
+      }
+
+      if (due > BENCH_FAKE_CHUNK) due = BENCH_FAKE_CHUNK;
+
+      count = due;
+
+      for (i=0; i<count; i++)
+      {
+         level ^= (1 << fake_gpio(n++));
+
+         tick += step;
+
+         report[i].seqno = seqno++;
+         report[i].flags = 0;
+         report[i].tick  = (uint32_t)(int64_t)tick;
+         report[i].level = level;
+      }
+
+      if (send(fd, report, count * sizeof(gpioReport_t), MSG_NOSIGNAL) !=
+          count * sizeof(gpioReport_t)) break;
+
+      sent += count;
+   }
+}
+
+static gpointer fake_serve(gpointer user_data)
+{
+   cmdCmd_t cmd;
+   int fd;
+
+   fd = GPOINTER_TO_INT(user_data);
+
+   while (recv(fd, &cmd, sizeof(cmd), MSG_WAITALL) == sizeof(cmd))
+   {
+      switch (cmd.cmd)
+      {
+         case PI_CMD_HWVER: cmd.res = BENCH_FAKE_HWVER; break;
+
+         case PI_CMD_NOIB:  cmd.res = 0; break;
+
+         case PI_CMD_NB:
+            g_atomic_int_set(&bFakeBits, cmd.p2);
+            cmd.res = 0;
+            break;
+
+         case PI_CMD_NC:
+            g_atomic_int_set(&bFakeBits, 0);
+            cmd.res = 0;
+            break;
+
+         default: cmd.res = -1;
+      }
+
+      if (send(fd, &cmd, sizeof(cmd), MSG_NOSIGNAL) != sizeof(cmd)) break;
+
+      /* the socket now only carries reports */
+
+      if (cmd.cmd == PI_CMD_NOIB)
+      {
+         fake_stream(fd);
+         break;
+      }
+   }
+
+   close(fd);
+
+   return NULL;
+}
+
+static gpointer fake_accept(gpointer user_data)
+{
+   int fd;
+
+   while ((fd = accept(bFakeListen, NULL, NULL)) >= 0)
+   {
+      g_thread_unref(g_thread_new("fake", fake_serve, GINT_TO_POINTER(fd)));
+   }
+
+   return NULL;
+}
+
+static int fake_start(void)
+{
+   struct sockaddr_in addr;
+   socklen_t len;
+
+   bFakeListen = socket(AF_INET, SOCK_STREAM, 0);
+
+   if (bFakeListen < 0) return -1;
+
+   memset(&addr, 0, sizeof(addr));
+
+   addr.sin_family      = AF_INET;
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   addr.sin_port        = 0;
+
+   len = sizeof(addr);
+
+   if ((bind(bFakeListen, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+       (listen(bFakeListen, 4) < 0) ||
+       (getsockname(bFakeListen, (struct sockaddr *)&addr, &len) < 0))
+      return -1;
+
+   bFakePort = ntohs(addr.sin_port);
+
+   g_thread_unref(g_thread_new("fake", fake_accept, NULL));
+
+   return 0;
+}
+
+/* STREAM ----------------------------------------------------------------- */
+
+static GMainLoop *bLoop;
+static GArray    *bInput;  /* seconds per main_util_input */
+static GArray    *bFrame;  /* seconds per main_util_display */
+static GArray    *bLag;    /* seconds behind the fake pigpiod */
+
+static int stream_connect(void)
+{
+   struct sockaddr_in addr;
+   int fd;
+
+   fd = socket(AF_INET, SOCK_STREAM, 0);
+
+   if (fd < 0) return -1;
+
+   memset(&addr, 0, sizeof(addr));
+
+   addr.sin_family      = AF_INET;
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   addr.sin_port        = htons(bFakePort);
+
+   if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+   {
+      close(fd);
+      return -1;
+   }
+
+   return fd;
+}
+
+static double stream_lag(void)
+{
+   gint64 start;
+   int64_t stored;
+
+   start = __atomic_load_n(&bFakeStart, __ATOMIC_ACQUIRE);
+
+   if (!start || (gStore.next == gStore.first)) return 0.0;
+
+   stored = store_tick(&gStore, gStore.next - 1);
+
+   return ((g_get_monotonic_time() - start) - stored) / 1e6;
+}
+
+static gboolean stream_input(gpointer user_data)
+{
+   double t;
+
+   t = bench_now();
+
+   main_util_input(NULL);
+
+   t = bench_now() - t;
+
+   g_array_append_val(bInput, t);
+
+   return TRUE;
+}
+
+static gboolean stream_frame(gpointer user_data)
+{
+   double t, lag;
+
+   lag = stream_lag();
+
+   g_array_append_val(bLag, lag);
+
+   if (gStore.next == gStore.first) return TRUE;
+
+   main_util_view();
+
+   t = bench_now();
+
+   main_util_display();
+
+   t = bench_now() - t;
+
+   g_array_append_val(bFrame, t);
+
+   return TRUE;
+}
+
+static gboolean stream_stop(gpointer user_data)
+{
+   g_main_loop_quit(bLoop);
+
+   return FALSE;
+}
+
+/* run at one rate for some seconds, returns true if piscope kept up */
+
+static int stream_rate(int rate, int seconds)
+{
+   int cmd, notify, handle, bits, kept;
+   guint input, frame;
+   int64_t before;
+   uint64_t coarse;
+   double lag, stored;
+
+   bits = (bFakeChannels >= 32) ? -1 : ((1 << bFakeChannels) - 1);
+
+   g_atomic_int_set(&bFakeRate, rate);
+   __atomic_store_n(&bFakeStart, 0, __ATOMIC_RELEASE);
+
+   store_reset(&gStore);
+
+   cmd    = stream_connect();
+   notify = stream_connect();
+
+   if ((cmd < 0) || (notify < 0))
+   {
+      fprintf(stderr, "can't connect to the fake pigpiod\n");
+      exit(1);
+   }
+
+   gPigSocket = cmd;
+
+   handle = pigpioCommand(notify, PI_CMD_NOIB, 0, 0);
+
+   capture_start(notify);
+
+   gMode = piscope_live;
+   gInputState = piscope_running;
+
+   pigpioCommand(cmd, PI_CMD_HWVER, 0, 0);
+   pigpioCommand(cmd, PI_CMD_NB, handle, bits);
+
+   bInput = g_array_new(FALSE, FALSE, sizeof(double));
+   bFrame = g_array_new(FALSE, FALSE, sizeof(double));
+   bLag   = g_array_new(FALSE, FALSE, sizeof(double));
+
+   bLoop = g_main_loop_new(NULL, FALSE);
+
+   input = g_timeout_add(1000/gInputUpdateHz,  stream_input, NULL);
+   frame = g_timeout_add(1000/gOutputUpdateHz, stream_frame, NULL);
+
+   g_timeout_add(seconds * 1000, stream_stop, NULL);
+
+   before = gStore.next;
+   coarse = gHudCoarse;
+
+   g_main_loop_run(bLoop);
+
+   g_source_remove(input);
+   g_source_remove(frame);
+
+   g_main_loop_unref(bLoop);
+
+   lag    = stream_lag();
+   stored = gStore.next - before;
+
+   pigpioCommand(cmd, PI_CMD_NC, handle, 0);
+
+   capture_stop();
+
+   close(cmd);
+   close(notify);
+
+   gPigSocket = -1;
+
+   kept = ((lag * 1000.0) < BENCH_LAG_LIMIT_MS) &&
+          (stored >= (0.95 * rate * seconds));
+
+   printf("%d edges/s, %d channels: %.0f samples/s stored, lag %.1f ms, %s\n",
+      rate, bFakeChannels, stored / seconds, lag * 1000.0,
+      kept ? "kept up" : "FELL BEHIND");
+
+   bench_stats("input",   bInput, 1e3, "ms");
+   bench_stats("display", bFrame, 1e3, "ms");
+   bench_stats("lag",     bLag,   1e3, "ms");
+
+   printf("   %u of %u frames drawn at reduced detail\n",
+      (unsigned)(gHudCoarse - coarse), bFrame->len);
+
+   g_array_free(bInput, TRUE);
+   g_array_free(bFrame, TRUE);
+   g_array_free(bLag,   TRUE);
+
+   return kept;
+}
+
+static int stream_main(int argc, char *argv[])
+{
+   int opt, rate, seconds, bufferMB, best;
+
+   rate     = 0;
+   seconds  = 5;
+   bufferMB = 256;
+
+   bFakeChannels = 8;
+   bFakeMix      = bench_clock;
+
+   while ((opt = getopt(argc, argv, "r:c:m:t:b:")) != -1)
+   {
+      switch (opt)
+      {
+         case 'r': rate = atoi(optarg); break;
+         case 'c': bFakeChannels = atoi(optarg); break;
+         case 'm': bFakeMix = strcmp(optarg, "random") ? bench_clock : bench_random; break;
+         case 't': seconds = atoi(optarg); break;
+         case 'b': bufferMB = atoi(optarg); break;
+         default:
+            fprintf(stderr, "usage: piscope_bench stream [-r edges/s] "
+               "[-c channels] [-m clock|random] [-t seconds] [-b MB]\n");
+            return 1;
+      }
+   }
+
+   if (bFakeChannels < 1)  bFakeChannels = 1;
+   if (bFakeChannels > 32) bFakeChannels = 32;
+   if (seconds < 1) seconds = 1;
+
+   bench_init(bufferMB);
+
+   bench_surface(BENCH_WIDTH, BENCH_HEIGHT, bFakeChannels);
+
+   if (fake_start() < 0)
+   {
+      fprintf(stderr, "can't start the fake pigpiod\n");
+      return 1;
+   }
+
+   printf("kernel %s, fake pigpiod on port %d\n", gKernelName, bFakePort);
+
+   if (rate) return !stream_rate(rate, seconds);
+
+   /* double the rate until piscope falls behind */
+
+   best = 0;
+
+   for (rate = 10000; rate <= (1 << 26); rate *= 2)
+   {
+      if (!stream_rate(rate, seconds)) break;
+
+      best = rate;
+   }
+
+   printf("maximum sustained rate %d edges/s\n", best);
+
+   return 0;
+}
+
+/* MICRO ------------------------------------------------------------------ */
+
+/*
+Each benchmark is a pass over the whole buffer.  One pass warms the
+caches, the median of the timed passes is printed so the numbers can be
+compared across commits.
+*/
+
+#define BENCH_MICRO_REPS       7
+#define BENCH_MICRO_QUERIES    (1<<18)
+#define BENCH_MICRO_FRAMES     50
+
+typedef struct
+{
+   const char   *name;
+   gpioReport_t *report;
+   int           count;
+} microData_t;
+
+static microData_t *bData;
+static uint32_t    *bLevel;   /* levels of the stored samples */
+static int64_t     *bQuery;   /* random ticks inside the buffer */
+static double       bOps;     /* operations done by the last pass */
+static double       bSamples; /* samples handled by the last pass */
+static int          bKernelBad; /* a kernel differs from ingest_scalar */
+static int          bIdleBad;   /* idle trigger hits differ */
+
+static const int bZoomLevels[] = {3, 6, 9, 12, 15, 18};
+
+static void bench_zoom(int level)
+{
+   gZoomLevel = level;
+   gDeciMicroPerPix = gZoomDeciMicroPerPix[level];
+   gViewTicks = (((int64_t)gCoscWidth * gDeciMicroPerPix)/10);
+}
+
+/* a wrapping run of reports toggling bFakeChannels gpios */
+
+static void micro_synth(microData_t *d, int count)
+{
+   uint32_t level, tick;
+   int i;
+
+   srand(1);
+
+   d->name   = "synthetic";
+   d->report = g_malloc(count * sizeof(gpioReport_t));
+   d->count  = count;
+
+   level = 0;
+   tick  = 0xFFFFFFFF - (count / 2) * 3; /* wraps half way */
+
+   for (i=0; i<count; i++)
+   {
+      level ^= (1 << fake_gpio(i));
+      tick  += 2 + (rand() & 3);
+
+      d->report[i].seqno = i;
+      d->report[i].flags = 0;
+      d->report[i].tick  = tick;
+      d->report[i].level = level;
+   }
+}
+
+/* the samples of a .piscope file, played back as reports */
+
+static int micro_file(microData_t *d, char *filename)
+{
+   int64_t n;
+   int i;
+
+   store_reset(&gStore);
+
+   if (file_load(filename) || (gStore.next == gStore.first)) return -1;
+
+   d->name   = filename;
+   d->count  = gStore.next - gStore.first;
+   d->report = g_malloc(d->count * sizeof(gpioReport_t));
+
+   for (i=0, n=gStore.first; n<gStore.next; i++, n++)
+   {
+      d->report[i].seqno = i;
+      d->report[i].flags = 0;
+      d->report[i].tick  = store_tick(&gStore, n);
+      d->report[i].level = store_level(&gStore, n);
+   }
+
+   return 0;
+}
+
+/* four triggers (one timed) and two counters, all counting only */
+
+static void micro_triggers(void)
+{
+   static const int types[PISCOPE_TRIGGERS] =
+      {piscope_rising, piscope_edge, piscope_falling, piscope_high_gt};
+   int i;
+
+   for (i=0; i<PISCOPE_TRIGGERS; i++)
+   {
+      memset(gSettings.triggers[i].gpiotypes, 0,
+         sizeof(gSettings.triggers[i].gpiotypes));
+
+      gSettings.triggers[i].gpiotypes[i] = types[i];
+      gSettings.triggers[i].micros = 50;
+
+      gTrigInfo[i].enabled = 1;
+      gTrigInfo[i].when = piscope_count;
+
+      util_setTriggerGPIOTypes(i);
+   }
+
+   gSettings.counters = 2;
+
+   for (i=0; i<gSettings.counters; i++)
+   {
+      memset(gSettings.counter[i].gpiotypes, 0,
+         sizeof(gSettings.counter[i].gpiotypes));
+
+      gSettings.counter[i].gpiotypes[0]   = piscope_high;
+      gSettings.counter[i].gpiotypes[i+1] = piscope_rising;
+   }
+
+   engine_compile();
+}
+
+/* the ring drained by main_util_input, as the capture thread fills it */
+
+/* the trigger hits indexed in gStore */
+
+static int micro_idleHits(int64_t *hit, int max)
+{
+   int64_t s, last;
+   int hits;
+
+   last = gStore.next - 1;
+   hits = 0;
+
+   for (s=store_nextHit(&gStore, gStore.first, last); (s >= 0) && (hits < max);
+        s=store_nextHit(&gStore, s, last))
+   {
+      hit[hits++] = s;
+   }
+
+   return hits;
+}
+
+/*
+Idle triggers on gpio 0, alone, with a level, with a rising edge and
+with gpio 3 also idle, over reports which go quiet now and then with
+only watchdog and keep-alive reports coming.
+*/
+
+static void micro_idleTriggers(gpioReport_t *report, int count)
+{
+   static const int types[PISCOPE_TRIGGERS][4] =
+   {
+      {piscope_idle_gt, 0,              0,            0},
+      {piscope_idle_gt, 0,              piscope_high, 0},
+      {piscope_idle_gt, piscope_rising, 0,            0},
+      {piscope_idle_gt, 0,              0,            piscope_idle_gt},
+   };
+   uint32_t level, tick;
+   int i, g, quiet;
+
+   for (i=0; i<PISCOPE_TRIGGERS; i++)
+   {
+      memset(gSettings.triggers[i].gpiotypes, 0,
+         sizeof(gSettings.triggers[i].gpiotypes));
+
+      for (g=0; g<4; g++) gSettings.triggers[i].gpiotypes[g] = types[i][g];
+
+      gSettings.triggers[i].micros = 1000;
+
+      gTrigInfo[i].enabled = 1;
+      gTrigInfo[i].when = piscope_count;
+
+      util_setTriggerGPIOTypes(i);
+   }
+
+   gSettings.counters = 0;
+
+   engine_compile();
+
+   srand(3);
+
+   level = 0;
+   tick  = 0xFFFFFFFF - (count / 2) * 100; /* wraps half way */
+   quiet = 0;
+
+   for (i=0; i<count; i++)
+   {
+      report[i].seqno = i;
+      report[i].flags = 0;
+
+      if (quiet)
+      {
+         quiet--;
+
+         tick += 200 + (rand() % 200);
+
+         if (rand() % 8) report[i].flags = PI_NTFY_FLAGS_WDOG;
+         else            report[i].flags = PI_NTFY_FLAGS_ALIVE;
+      }
+      else
+      {
+         if (!(rand() % 50)) quiet = rand() % 20;
+
+         tick  += 1 + (rand() % 400);
+         level ^= 1 << (rand() % 4);
+      }
+
+      report[i].tick  = tick;
+      report[i].level = level;
+   }
+}
+
+/* ingest the reports in runs of up to maxRun, returns the hits indexed */
+
+static int micro_idleFeed
+   (gpioReport_t *report, int count, int maxRun, int64_t *hit, int *hitCount)
+{
+   int r, run, pos, part, i;
+
+   store_reset(&gStore);
+
+   for (i=0; i<PISCOPE_TRIGGERS; i++) gTrigInfo[i].count = 0;
+
+   gCapHead = 0;
+   gCapTail = 0;
+
+   for (r=0; r<count; r+=run)
+   {
+      run = 1 + (rand() % maxRun);
+
+      if (run > (count - r)) run = count - r;
+
+      pos  = gCapHead & (PISCOPE_CAPTURE_REPORTS - 1);
+      part = PISCOPE_CAPTURE_REPORTS - pos;
+
+      if (part > run) part = run;
+
+      memcpy(&gCapRing[pos], &report[r], part * sizeof(gpioReport_t));
+      memcpy(&gCapRing[0], &report[r+part],
+         (run - part) * sizeof(gpioReport_t));
+
+      gCapHead += run;
+
+      while (gCapTail != gCapHead) main_util_input(NULL);
+   }
+
+   for (i=0; i<PISCOPE_TRIGGERS; i++) hitCount[i] = gTrigInfo[i].count;
+
+   return micro_idleHits(hit, count);
+}
+/*
+Check that the hits indexed as the reports arrive are those hits_rebuild
+finds, and that neither they nor the trigger counts depend on how the
+reports were batched.  Returns the checks which fail.
+*/
+
+static int micro_idleCheck(void)
+{
+   gpioReport_t *report;
+   int64_t *hit[3];
+   int hits[3], count[2][PISCOPE_TRIGGERS], i, bad;
+
+   report = g_malloc(BENCH_IDLE_REPORTS * sizeof(gpioReport_t));
+
+   for (i=0; i<3; i++) hit[i] = g_malloc(BENCH_IDLE_REPORTS * sizeof(int64_t));
+
+   micro_idleTriggers(report, BENCH_IDLE_REPORTS);
+
+   hits[0] = micro_idleFeed(report, BENCH_IDLE_REPORTS,
+      PISCOPE_CAPTURE_REPORTS/2, hit[0], count[0]);
+
+   hits[1] = micro_idleFeed(report, BENCH_IDLE_REPORTS, 1, hit[1], count[1]);
+
+   hits_rebuild();
+
+   hits[2] = micro_idleHits(hit[2], BENCH_IDLE_REPORTS);
+
+   printf("idle triggers: %d hits, counts %d %d %d %d\n",
+      hits[1], count[1][0], count[1][1], count[1][2], count[1][3]);
+
+   bad = 0;
+
+   if ((hits[0] != hits[1]) ||
+       memcmp(hit[0], hit[1], hits[1] * sizeof(int64_t)) ||
+       memcmp(count[0], count[1], sizeof(count[0])))
+   {
+      printf("   idle trigger hits differ as the reports are batched\n");
+      bad++;
+   }
+
+   if ((hits[2] != hits[1]) ||
+       memcmp(hit[2], hit[1], hits[1] * sizeof(int64_t)))
+   {
+      printf("   idle trigger hits differ after hits_rebuild\n");
+      bad++;
+   }
+
+   for (i=0; i<3; i++) g_free(hit[i]);
+
+   g_free(report);
+
+   return bad;
+}
+
+static double micro_insert(void)
+{
+   int r, chunk, pos, part;
+   double t;
+
+   store_reset(&gStore);
+
+   gCapHead = 0;
+   gCapTail = 0;
+
+   t = 0.0;
+
+   for (r=0; r<bData->count; r+=chunk)
+   {
+      chunk = bData->count - r;
+
+      if (chunk > (PISCOPE_CAPTURE_REPORTS/2)) chunk = PISCOPE_CAPTURE_REPORTS/2;
+
+      pos  = gCapHead & (PISCOPE_CAPTURE_REPORTS - 1);
+      part = PISCOPE_CAPTURE_REPORTS - pos;
+
+      if (part > chunk) part = chunk;
+
+      memcpy(&gCapRing[pos], &bData->report[r], part * sizeof(gpioReport_t));
+      memcpy(&gCapRing[0], &bData->report[r+part],
+         (chunk - part) * sizeof(gpioReport_t));
+
+      gCapHead += chunk;
+
+      t -= bench_now();
+
+      while (gCapTail != gCapHead) main_util_input(NULL);
+
+      t += bench_now();
+   }
+
+   bOps     = bData->count;
+   bSamples = gStore.next - gStore.first;
+
+   return t;
+}
+
+/*
+Check gKernel against ingest_scalar over random runs of reports, with
+tick wraps, repeated levels, odd counts and unaligned starts.  Returns
+the runs which differ.
+*/
+
+static int micro_kernelCheck(int runs)
+{
+   static gpioReport_t report[PISCOPE_ENGINE_BATCH + 4];
+   static int64_t tick[2][PISCOPE_ENGINE_BATCH];
+   static uint32_t level[2][PISCOPE_ENGINE_BATCH];
+   piscopeIngest_t in[2];
+   uint32_t t, l;
+   int run, i, off, count, n[2], bad;
+
+   srand(1);
+
+   bad = 0;
+
+   for (run=0; run<runs; run++)
+   {
+      off   = rand() % 4;
+      count = rand() % (PISCOPE_ENGINE_BATCH + 1);
+
+      /* most runs start close enough to wrap the tick */
+
+      t = 0xFFFFFFFF - (rand() % (64 * PISCOPE_ENGINE_BATCH));
+      l = rand();
+
+      memset(&in[0], 0, sizeof(in[0]));
+
+      in[0].high      = (int64_t)(rand() % 4) << 32;
+      in[0].lastTick  = t;
+      in[0].lastLevel = l;
+
+      in[1] = in[0];
+
+      for (i=0; i<count; i++)
+      {
+         t += 1 + (rand() % 64);
+
+         if (rand() & 1) l ^= 1u << (rand() % 32);
+
+         report[off+i].seqno = i;
+         report[off+i].flags = 0;
+         report[off+i].tick  = t;
+         report[off+i].level = l;
+      }
+
+      n[0] = ingest_scalar(report+off, count, &in[0], tick[0], level[0]);
+      n[1] = gKernel(report+off, count, &in[1], tick[1], level[1]);
+
+      if ((n[0] != n[1]) ||
+          memcmp(tick[0], tick[1], n[0] * sizeof(int64_t)) ||
+          memcmp(level[0], level[1], n[0] * sizeof(uint32_t)) ||
+          (in[0].high != in[1].high) ||
+          (in[0].lastTick != in[1].lastTick) ||
+          (in[0].lastLevel != in[1].lastLevel)) bad++;
+   }
+
+   return bad;
+}
+
+static double micro_kernel(void)
+{
+   static int64_t tick[PISCOPE_ENGINE_BATCH];
+   static uint32_t level[PISCOPE_ENGINE_BATCH];
+   piscopeIngest_t in;
+   int r, batch;
+   double t;
+
+   memset(&in, 0, sizeof(in));
+
+   in.lastTick  = bData->report[0].tick;
+   in.lastLevel = bData->report[0].level;
+
+   bSamples = 0;
+
+   t = bench_now();
+
+   for (r=0; r<bData->count; r+=batch)
+   {
+      batch = bData->count - r;
+
+      if (batch > PISCOPE_ENGINE_BATCH) batch = PISCOPE_ENGINE_BATCH;
+
+      bSamples += gKernel(&bData->report[r], batch, &in, tick, level);
+   }
+
+   t = bench_now() - t;
+
+   bOps = bData->count;
+
+   return t;
+}
+
+static double micro_match(void)
+{
+   static uint64_t matched[PISCOPE_ENGINE_BATCH];
+   int s, samples, batch;
+   double t;
+
+   samples = gStore.next - gStore.first;
+
+   t = bench_now();
+
+   for (s=1; s<samples; s+=batch)
+   {
+      batch = samples - s;
+
+      if (batch > PISCOPE_ENGINE_BATCH) batch = PISCOPE_ENGINE_BATCH;
+
+      engine_matchBatch(&bLevel[s], bLevel[s-1], batch, matched);
+   }
+
+   t = bench_now() - t;
+
+   bOps     = samples - 1;
+   bSamples = samples - 1;
+
+   return t;
+}
+
+static double micro_bsearch(void)
+{
+   int64_t last, sum;
+   double t;
+   int i;
+
+   last = gStore.next - 1;
+   sum  = 0;
+
+   t = bench_now();
+
+   for (i=0; i<BENCH_MICRO_QUERIES; i++)
+      sum += main_util_bsearch(gStore.first, last, &bQuery[i]);
+
+   t = bench_now() - t;
+
+   if (sum == -1) printf("\n"); /* keep the searches */
+
+   bOps     = BENCH_MICRO_QUERIES;
+   bSamples = 0;
+
+   return t;
+}
+
+static double micro_searchEdge(void)
+{
+   double t;
+   int i;
+
+   t = 0.0;
+
+   for (i=0; i<BENCH_MICRO_QUERIES; i++)
+   {
+      gBlueTick = bQuery[i];
+
+      t -= bench_now();
+
+      main_util_searchEdge(i & 1);
+
+      t += bench_now();
+   }
+
+   bOps     = BENCH_MICRO_QUERIES;
+   bSamples = 0;
+
+   return t;
+}
+
+static double micro_display(void)
+{
+   double t;
+   int i;
+
+   t = 0.0;
+
+   bSamples = 0;
+
+   for (i=0; i<BENCH_MICRO_FRAMES; i++)
+   {
+      gViewCentreTick = bQuery[i];
+
+      main_util_view();
+
+      /* drawn afresh, neither composited nor copied from tiles */
+
+      gWaveValid = 0;
+      gTileGen++;
+      gFrameLoad = 0;
+
+      t -= bench_now();
+
+      main_util_display();
+
+      t += bench_now();
+
+      bSamples += gViewEndSample - gViewStartSample + 1;
+   }
+
+   bOps = BENCH_MICRO_FRAMES;
+
+   return t;
+}
+
+static void micro_run(const char *name, double (*pass)(void), const char *unit)
+{
+   double t[BENCH_MICRO_REPS], median;
+   int i;
+
+   pass();
+
+   for (i=0; i<BENCH_MICRO_REPS; i++) t[i] = pass();
+
+   qsort(t, BENCH_MICRO_REPS, sizeof(double), bench_cmpDouble);
+
+   median = t[BENCH_MICRO_REPS/2];
+
+   if (median <= 0.0) median = 1e-9;
+
+   printf("   %-24s %12.1f ns/%-7s", name, 1e9 * median / bOps, unit);
+
+   if (bSamples) printf(" %14.0f samples/s\n", bSamples / median);
+   else          printf(" %14.0f %s/s\n", bOps / median, unit);
+}
+
+static void micro_dataset(microData_t *d)
+{
+   static const char *kernels[] = {"scalar", "sse2", "avx2", "neon"};
+   const char *want;
+   int64_t n, first, span;
+   uint32_t changed;
+   char name[64];
+   int i, g, bad;
+
+   bData = d;
+
+   printf("%s: %d reports\n", d->name, d->count);
+
+   micro_run("insert", micro_insert, "report");
+
+   /* each kernel the CPU runs, selected as PISCOPE_KERNEL would */
+
+   want = getenv("PISCOPE_KERNEL");
+
+   for (i=0; i<(sizeof(kernels)/sizeof(kernels[0])); i++)
+   {
+      setenv("PISCOPE_KERNEL", kernels[i], 1);
+
+      ingest_init();
+
+      if (strcmp(gKernelName, kernels[i])) continue;
+
+      if ((bad = micro_kernelCheck(BENCH_KERNEL_RUNS)))
+      {
+         printf("   kernel %s differs from scalar in %d of %d runs\n",
+            gKernelName, bad, BENCH_KERNEL_RUNS);
+
+         bKernelBad = 1;
+      }
+
+      sprintf(name, "kernel %s", gKernelName);
+
+      micro_run(name, micro_kernel, "report");
+   }
+
+   if (want) setenv("PISCOPE_KERNEL", want, 1);
+   else      unsetenv("PISCOPE_KERNEL");
+
+   ingest_init();
+
+   /* the rest work on the samples left by the last insert */
+
+   first = gStore.first;
+
+   bLevel = g_realloc(bLevel, (gStore.next - first) * sizeof(uint32_t));
+
+   changed = 0;
+
+   for (n=first; n<gStore.next; n++)
+   {
+      bLevel[n-first] = store_level(&gStore, n);
+
+      if (n > first) changed |= bLevel[n-first] ^ bLevel[n-first-1];
+   }
+
+   span = store_tick(&gStore, gStore.next - 1) - store_tick(&gStore, first);
+
+   srand(2);
+
+   for (i=0; i<BENCH_MICRO_QUERIES; i++)
+   {
+      bQuery[i] = store_tick(&gStore, first) +
+         (int64_t)(((double)rand() / RAND_MAX) * span);
+   }
+
+   micro_run("match", micro_match, "sample");
+
+   micro_run("bsearch", micro_bsearch, "search");
+
+   gHilitGpios = 0;
+
+   micro_run("searchEdge any", micro_searchEdge, "search");
+
+   /* the gpio with the fewest edges in a clock mix */
+
+   g = changed ? (31 - __builtin_clz(changed)) : 0;
+
+   gHilitGpios = 1 << g;
+
+   sprintf(name, "searchEdge gpio %d", g);
+
+   micro_run(name, micro_searchEdge, "search");
+
+   gHilitGpios = 0;
+
+   for (i=0; i<(sizeof(bZoomLevels)/sizeof(bZoomLevels[0])); i++)
+   {
+      bench_zoom(bZoomLevels[i]);
+
+      sprintf(name, "display %u dus/pix", gDeciMicroPerPix);
+
+      micro_run(name, micro_display, "frame");
+   }
+}
+
+static int micro_main(int argc, char *argv[])
+{
+   microData_t d;
+   int opt, count, channels, i;
+
+   count    = 2000000;
+   channels = 8;
+
+   bFakeMix = bench_clock;
+
+   while ((opt = getopt(argc, argv, "n:c:m:")) != -1)
+   {
+      switch (opt)
+      {
+         case 'n': count = atoi(optarg); break;
+         case 'c': channels = atoi(optarg); break;
+         case 'm': bFakeMix = strcmp(optarg, "random") ? bench_clock : bench_random; break;
+         default:
+            fprintf(stderr, "usage: piscope_bench micro [-n samples] "
+               "[-c channels] [-m clock|random] [file.piscope ...]\n");
+            return 1;
+      }
+   }
+
+   if (count < 2) count = 2;
+   if (channels < 1)  channels = 1;
+   if (channels > 32) channels = 32;
+
+   bFakeChannels = channels;
+
+   bench_init(1024);
+
+   bench_surface(BENCH_WIDTH, BENCH_HEIGHT, channels);
+
+   micro_triggers();
+
+   bQuery = g_malloc(BENCH_MICRO_QUERIES * sizeof(int64_t));
+
+   gMode = piscope_pause;
+   gInputState = piscope_running;
+
+   printf("kernel %s, %d channels\n", gKernelName, channels);
+
+   bIdleBad = micro_idleCheck();
+
+   micro_triggers();
+
+   micro_synth(&d, count);
+   micro_dataset(&d);
+   g_free(d.report);
+
+   for (i=optind; i<argc; i++)
+   {
+      if (micro_file(&d, argv[i]) < 0)
+      {
+         fprintf(stderr, "can't load %s\n", argv[i]);
+         continue;
+      }
+
+      micro_dataset(&d);
+      g_free(d.report);
+   }
+
+   return (bKernelBad || bIdleBad);
+}
+
+/* RENDER ----------------------------------------------------------------- */
+
+/*
+Every zoom level is drawn at evenly spaced pan positions over each
+capture.  A checksum of the pixels of each frame is kept so a changed
+renderer can be checked against the output of the one before it.
+*/
+
+#define BENCH_RENDER_PANS      8
+#define BENCH_RENDER_REPEATS   5
+
+typedef struct
+{
+   char     name[256];
+   uint32_t zoom;
+   int      pan;
+   uint64_t sum;
+} renderSum_t;
+
+static GArray *bSums;     /* renderSum_t of this run */
+static GArray *bRefSums;  /* renderSum_t read from -k, or NULL */
+static int     bBackBad;  /* frames on the way back unlike the way out */
+static int     bBackLen;
+
+/* FNV-1a over the visible pixels, the padding of each row is skipped */
+
+static uint64_t render_checksum(void)
+{
+   uint64_t h;
+   uint8_t *row;
+   int x, y, stride;
+
+   cairo_surface_flush(gCoscSurface);
+
+   row    = cairo_image_surface_get_data(gCoscSurface);
+   stride = cairo_image_surface_get_stride(gCoscSurface);
+
+   h = 0xcbf29ce484222325ULL;
+
+   for (y=0; y<gCoscHeight; y++, row+=stride)
+   {
+      for (x=0; x<(gCoscWidth*4); x++)
+      {
+         h ^= row[x];
+         h *= 0x100000001b3ULL;
+      }
+   }
+
+   return h;
+}
+
+/*
+A line of a sums file is the zoom, pan and checksum of a frame followed
+by the capture name, which runs to the end of the line and so may hold
+spaces.
+*/
+
+static int render_readSums(const char *filename)
+{
+   renderSum_t rs;
+   unsigned long long sum;
+   char line[512];
+   FILE *in;
+   int n, len, lineNum;
+
+   in = fopen(filename, "r");
+
+   if (in == NULL) return -1;
+
+   lineNum = 0;
+
+   while (fgets(line, sizeof(line), in) != NULL)
+   {
+      lineNum++;
+
+      len = strlen(line);
+
+      if (len && (line[len-1] == '\n')) line[--len] = 0;
+
+      n = 0;
+
+      if ((sscanf(line, "%u %d %llx %n", &rs.zoom, &rs.pan, &sum, &n) < 3) ||
+          !n || (line[n] == 0) || ((len - n) >= sizeof(rs.name)))
+      {
+         fprintf(stderr, "%s:%d: not zoom pan checksum name\n",
+            filename, lineNum);
+
+         fclose(in);
+
+         return -1;
+      }
+
+      strcpy(rs.name, line + n);
+
+      rs.sum = sum;
+      g_array_append_val(bRefSums, rs);
+   }
+
+   fclose(in);
+
+   return 0;
+}
+
+/*
+1 if the reference holds a different checksum for the frame, or none at
+all, as after a renamed capture or a changed -p or -w.
+*/
+
+static int render_mismatch(renderSum_t *rs)
+{
+   renderSum_t *ref;
+   int i;
+
+   if (!bRefSums) return 0;
+
+   for (i=0; i<bRefSums->len; i++)
+   {
+      ref = &g_array_index(bRefSums, renderSum_t, i);
+
+      if ((ref->zoom == rs->zoom) && (ref->pan == rs->pan) &&
+          !strcmp(ref->name, rs->name))
+      {
+         if (ref->sum == rs->sum) return 0;
+
+         printf("   checksum differs at %u dus/pix pan %d\n",
+            rs->zoom, rs->pan);
+
+         return 1;
+      }
+   }
+
+   printf("   no reference checksum at %u dus/pix pan %d\n",
+      rs->zoom, rs->pan);
+
+   return 1;
+}
+
+/* the view centre of pan p of pans across the capture */
+
+static int64_t render_pan(int64_t first, int64_t span, int p, int pans)
+{
+   return first + (int64_t)(span * ((p + 0.5) / pans));
+}
+
+/*
+Pan across the zoom untimed and then back timed, so that while paused
+the way back is copied from the tiles left by the way out.  The frames
+which differ from those drawn on the way out are counted in bBackBad.
+*/
+
+static void render_back(int64_t first, int64_t span, int pans, GArray *frame)
+{
+   uint64_t *sum;
+   int p;
+   double t;
+
+   sum = g_malloc(pans * sizeof(uint64_t));
+
+   g_array_set_size(frame, 0);
+
+   gTileGen++;
+
+   for (p=0; p<pans; p++)
+   {
+      gViewCentreTick = render_pan(first, span, p, pans);
+
+      main_util_view();
+
+      gWaveValid = 0;
+      gFrameLoad = 0;
+
+      main_util_display();
+
+      sum[p] = render_checksum();
+   }
+
+   for (p=pans-1; p>=0; p--)
+   {
+      gViewCentreTick = render_pan(first, span, p, pans);
+
+      main_util_view();
+
+      gWaveValid = 0;
+      gFrameLoad = 0;
+
+      t = bench_now();
+
+      main_util_display();
+
+      t = bench_now() - t;
+
+      g_array_append_val(frame, t);
+
+      if (render_checksum() != sum[p])
+      {
+         printf("   cached frame differs at %u dus/pix pan %d\n",
+            gDeciMicroPerPix, p);
+
+         bBackBad++;
+      }
+
+      bBackLen++;
+   }
+
+   g_free(sum);
+
+   bench_stats("back", frame, 1e6, "us");
+}
+
+/* sweep the capture in gStore, returns the number of mismatched frames */
+
+static int render_capture(const char *name, int pans, int repeats, GArray *all)
+{
+   GArray *frame;
+   renderSum_t rs;
+   int64_t first, last, span;
+   uint32_t changed, level, prev;
+   uint64_t zoomSum;
+   int64_t n;
+   int z, p, r, g, bad;
+   double t;
+   char label[32];
+
+   first = store_tick(&gStore, gStore.first);
+   last  = store_tick(&gStore, gStore.next - 1);
+   span  = last - first;
+
+   /* show every gpio which changes */
+
+   changed = 0;
+   prev = store_level(&gStore, gStore.first);
+
+   for (n=gStore.first+1; n<gStore.next; n++)
+   {
+      level = store_level(&gStore, n);
+      changed |= level ^ prev;
+      prev = level;
+   }
+
+   g = changed ? (32 - __builtin_clz(changed)) : 1;
+
+   bench_surface(gCoscWidth, gCoscHeight, g);
+
+   gGoldTick = first;
+   gBlueTick = first + (span / 3);
+
+   printf("%s: %"PRId64" samples, %d gpios, %.6f seconds\n",
+      name, gStore.next - gStore.first, g, span / 1e6);
+
+   frame = g_array_new(FALSE, FALSE, sizeof(double));
+
+   bad = 0;
+
+   for (z=0; z<(sizeof(gZoomDeciMicroPerPix)/sizeof(gZoomDeciMicroPerPix[0])); z++)
+   {
+      bench_zoom(z);
+
+      g_array_set_size(frame, 0);
+
+      zoomSum = 0;
+
+      for (p=0; p<pans; p++)
+      {
+         gViewCentreTick = render_pan(first, span, p, pans);
+
+         main_util_view();
+
+         for (r=0; r<repeats; r++)
+         {
+            /* an unmoved view is otherwise only composited, or copied
+               from the tiles of the last repeat */
+
+            gWaveValid = 0;
+            gTileGen++;
+            gFrameLoad = 0;
+
+            t = bench_now();
+
+            main_util_display();
+
+            t = bench_now() - t;
+
+            g_array_append_val(frame, t);
+            g_array_append_val(all, t);
+         }
+
+         snprintf(rs.name, sizeof(rs.name), "%s", name);
+         rs.zoom = gDeciMicroPerPix;
+         rs.pan  = p;
+         rs.sum  = render_checksum();
+
+         g_array_append_val(bSums, rs);
+
+         zoomSum ^= rs.sum + p;
+
+         bad += render_mismatch(&rs);
+      }
+
+      sprintf(label, "%u", gDeciMicroPerPix);
+
+      bench_stats(label, frame, 1e6, "us");
+
+      printf("   %-8s checksum %016"PRIx64"\n", "", zoomSum);
+
+      render_back(first, span, pans, frame);
+   }
+
+   g_array_free(frame, TRUE);
+
+   return bad;
+}
+
+static int render_main(int argc, char *argv[])
+{
+   microData_t d;
+   GArray *all;
+   renderSum_t *rs;
+   const char *out, *ref;
+   FILE *fp;
+   int opt, pans, repeats, width, height, count, bad, i;
+
+   pans     = BENCH_RENDER_PANS;
+   repeats  = BENCH_RENDER_REPEATS;
+   width    = BENCH_WIDTH;
+   height   = BENCH_HEIGHT;
+   count    = 0;
+   out      = NULL;
+   ref      = NULL;
+
+   bFakeChannels = 8;
+   bFakeMix      = bench_clock;
+
+   while ((opt = getopt(argc, argv, "p:r:w:h:n:o:k:")) != -1)
+   {
+      switch (opt)
+      {
+         case 'p': pans = atoi(optarg); break;
+         case 'r': repeats = atoi(optarg); break;
+         case 'w': width = atoi(optarg); break;
+         case 'h': height = atoi(optarg); break;
+         case 'n': count = atoi(optarg); break;
+         case 'o': out = optarg; break;
+         case 'k': ref = optarg; break;
+         default:
+            fprintf(stderr, "usage: piscope_bench render [-p pans] "
+               "[-r repeats] [-w width] [-h height] [-n samples] "
+               "[-o sums] [-k sums] [file.piscope ...]\n");
+            return 1;
+      }
+   }
+
+   if (pans < 1)    pans = 1;
+   if (repeats < 1) repeats = 1;
+   if (width < 16)  width = 16;
+   if (height < 16) height = 16;
+
+   /* without captures a synthetic buffer is drawn */
+
+   if ((optind == argc) && !count) count = 1000000;
+
+   bench_init(1024);
+
+   bench_surface(width, height, 1);
+
+   gMode = piscope_pause;
+   gInputState = piscope_running;
+
+   bSums = g_array_new(FALSE, FALSE, sizeof(renderSum_t));
+
+   if (ref)
+   {
+      bRefSums = g_array_new(FALSE, FALSE, sizeof(renderSum_t));
+
+      if (render_readSums(ref) < 0)
+      {
+         fprintf(stderr, "can't read %s\n", ref);
+         return 1;
+      }
+   }
+
+   all = g_array_new(FALSE, FALSE, sizeof(double));
+
+   bad = 0;
+
+   if (count)
+   {
+      micro_synth(&d, count);
+
+      bData = &d;
+      micro_insert();
+
+      bad += render_capture(d.name, pans, repeats, all);
+
+      g_free(d.report);
+   }
+
+   for (i=optind; i<argc; i++)
+   {
+      store_reset(&gStore);
+
+      if (file_load(argv[i]) || (gStore.next == gStore.first))
+      {
+         fprintf(stderr, "can't load %s\n", argv[i]);
+         continue;
+      }
+
+      bad += render_capture(argv[i], pans, repeats, all);
+   }
+
+   printf("all frames\n");
+
+   bench_stats("frame", all, 1e6, "us");
+
+   if (out)
+   {
+      fp = fopen(out, "w");
+
+      if (fp == NULL)
+      {
+         fprintf(stderr, "can't write %s\n", out);
+         return 1;
+      }
+
+      for (i=0; i<bSums->len; i++)
+      {
+         rs = &g_array_index(bSums, renderSum_t, i);
+
+         fprintf(fp, "%u %d %016"PRIx64" %s\n",
+            rs->zoom, rs->pan, rs->sum, rs->name);
+      }
+
+      fclose(fp);
+   }
+
+   if (ref)
+   {
+      printf("%d of %d frames differ from %s\n", bad, bSums->len, ref);
+   }
+
+   printf("%d of %d cached frames differ from the way out\n",
+      bBackBad, bBackLen);
+
+   g_array_free(all, TRUE);
+
+   return ((bad != 0) || (bBackBad != 0));
+}
+
+/* MAIN ------------------------------------------------------------------- */
+
+int main(int argc, char *argv[])
+{
+   if ((argc > 1) && !strcmp(argv[1], "stream"))
+      return stream_main(argc - 1, argv + 1);
+
+   if ((argc > 1) && !strcmp(argv[1], "micro"))
+      return micro_main(argc - 1, argv + 1);
+
+   if ((argc > 1) && !strcmp(argv[1], "render"))
+      return render_main(argc - 1, argv + 1);
+
+   fprintf(stderr, "usage: piscope_bench stream|micro|render [options]\n");
+
+   return 1;
+}